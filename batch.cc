@@ -0,0 +1,276 @@
+/* batch.cc
+
+Many small registers simulated side by side
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include "batch.h"
+#include "parallel.h"
+
+QStateBatch::QStateBatch(int qubits, int batch, uint64_t seed)
+	: _nQubits(qubits), _nStates((QIndex) 1 << qubits), _batch(batch),
+	  _rng(seed), _streams(0)
+{
+	assert(qubits >= 1 && batch >= 1);
+	_re.resize(_nStates * batch);
+	_im.resize(_nStates * batch);
+	Reset();
+}
+
+void QStateBatch::Reset()
+{
+	std::fill(_re.begin(), _re.end(), 0);
+	std::fill(_im.begin(), _im.end(), 0);
+	std::fill(_re.begin(), _re.begin() + _batch, 1);
+}
+
+void QStateBatch::Set(int s, const QState &q)
+{
+	assert(q.Qubits() == _nQubits && 0 <= s && s < _batch);
+	for (QIndex i = 0; i < _nStates; i++) {
+		Complex c = q.Amp(i);
+		_re[i * _batch + s] = real(c);
+		_im[i * _batch + s] = imag(c);
+	}
+}
+
+void QStateBatch::Get(int s, QState &q) const
+{
+	assert(q.Qubits() == _nQubits && 0 <= s && s < _batch);
+	std::vector<Complex> c(_nStates);
+	for (QIndex i = 0; i < _nStates; i++)
+		c[i] = Amp(s, i);
+	q.SetState(c);
+}
+
+QIndex QStateBatch::_Chunk() const
+//outcomes per unit of work, so that a unit is about PAR_CHUNK values
+{
+	return (PAR_CHUNK / _batch > 0) ? PAR_CHUNK / _batch : 1;
+}
+
+void QStateBatch::_Gate(QIndex mask, int bit, GateClass c, const Complex a[4])
+{
+	Workspace::Frame f(_scratch);
+	QReal *m = f.Get<QReal>(8 * _batch);
+
+	for (int k = 0; k < 4; k++) {
+		std::fill(m + k * _batch, m + (k + 1) * _batch, real(a[k]));
+		std::fill(m + (4 + k) * _batch, m + (5 + k) * _batch, imag(a[k]));
+	}
+	_Apply(mask, bit, c, m);
+}
+
+void QStateBatch::Apply(const SingleBit &g, int bit)
+{
+	Complex a[4];
+	g.GetMatrix(a);
+	_Gate(0, bit, g.Shape(), a);
+}
+
+void QStateBatch::Apply(const Controlled &g, QIndex mask, int bit)
+{
+	Complex a[4];
+	g.GetMatrix(a);
+	_Gate(mask, bit, g.Shape(), a);
+}
+
+void QStateBatch::_Apply(QIndex mask, int bit, GateClass c, const QReal *m)
+//m holds one matrix per register: the real parts of a00, a01, a10 and
+//a11 for all registers, then the imaginary parts. Pair k of every
+//register is (i0, i1), i0 being k with a 0 inserted at bit.
+{
+	const int B = _batch;
+	const QReal *m0r = m,         *m1r = m + B,     *m2r = m + 2 * B, *m3r = m + 3 * B;
+	const QReal *m0i = m + 4 * B, *m1i = m + 5 * B, *m2i = m + 6 * B, *m3i = m + 7 * B;
+	QIndex low  = ((QIndex) 1 << bit) - 1;
+	QIndex half = _nStates >> 1, k;
+
+	mask &= ~((QIndex) 1 << bit);
+
+	#pragma omp parallel for schedule(static) if(half * B > PAR_CHUNK)
+	for (k = 0; k < half; k++) {
+		QIndex i0 = ((k & ~low) << 1) | (k & low);
+		if ((i0 & mask) != mask) continue;
+		QIndex i1 = i0 | ((QIndex) 1 << bit);
+
+		QReal *ar = &_re[i0 * B], *ai = &_im[i0 * B];
+		QReal *br = &_re[i1 * B], *bi = &_im[i1 * B];
+		int s;
+
+		if (c == GATE_DIAGONAL) {
+			#pragma omp simd
+			for (s = 0; s < B; s++) {
+				QReal xr = ar[s], xi = ai[s], yr = br[s], yi = bi[s];
+				ar[s] = m0r[s] * xr - m0i[s] * xi;
+				ai[s] = m0r[s] * xi + m0i[s] * xr;
+				br[s] = m3r[s] * yr - m3i[s] * yi;
+				bi[s] = m3r[s] * yi + m3i[s] * yr;
+			}
+		} else if (c == GATE_ANTIDIAGONAL) {
+			#pragma omp simd
+			for (s = 0; s < B; s++) {
+				QReal xr = ar[s], xi = ai[s], yr = br[s], yi = bi[s];
+				ar[s] = m1r[s] * yr - m1i[s] * yi;
+				ai[s] = m1r[s] * yi + m1i[s] * yr;
+				br[s] = m2r[s] * xr - m2i[s] * xi;
+				bi[s] = m2r[s] * xi + m2i[s] * xr;
+			}
+		} else {
+			#pragma omp simd
+			for (s = 0; s < B; s++) {
+				QReal xr = ar[s], xi = ai[s], yr = br[s], yi = bi[s];
+				ar[s] = m0r[s] * xr - m0i[s] * xi + m1r[s] * yr - m1i[s] * yi;
+				ai[s] = m0r[s] * xi + m0i[s] * xr + m1r[s] * yi + m1i[s] * yr;
+				br[s] = m2r[s] * xr - m2i[s] * xi + m3r[s] * yr - m3i[s] * yi;
+				bi[s] = m2r[s] * xi + m2i[s] * xr + m3r[s] * yi + m3i[s] * yr;
+			}
+		}
+	}
+}
+
+QIndex QStateBatch::_Sums(QIndex mask, QAccum *part) const
+//probability of the outcomes i with (i & mask) == mask, per chunk of
+//_Chunk() outcomes and register: part[c*_batch + s]. Returns the
+//number of chunks; part must have room for _nStates/_Chunk()+1 of them.
+{
+	const int B = _batch;
+	QIndex chunk = _Chunk(), chunks = (_nStates + chunk - 1) / chunk, c;
+
+	std::fill(part, part + chunks * B, 0.0);
+
+	#pragma omp parallel for schedule(static) if(chunks > 1)
+	for (c = 0; c < chunks; c++) {
+		QIndex end = (c + 1) * chunk < _nStates ? (c + 1) * chunk : _nStates;
+		QAccum *p = &part[c * B];
+
+		for (QIndex i = c * chunk; i < end; i++) {
+			if ((i & mask) != mask) continue;
+			const QReal *r = &_re[i * B], *im = &_im[i * B];
+			#pragma omp simd
+			for (int s = 0; s < B; s++)
+				p[s] += (QAccum) r[s] * r[s] + (QAccum) im[s] * im[s];
+		}
+	}
+	return chunks;
+}
+
+std::vector<double> QStateBatch::Norms() const
+{
+	std::vector<QAccum> part((_nStates / _Chunk() + 1) * _batch);
+	std::vector<double> n(_batch, 0.0);
+	QIndex chunks = _Sums(0, &part[0]);
+
+	for (QIndex c = 0; c < chunks; c++)
+		for (int s = 0; s < _batch; s++)
+			n[s] += part[c * _batch + s];
+	return n;
+}
+
+std::vector<QIndex> QStateBatch::Measure()
+//as QState::_Pick() per register: find the chunk holding the random
+//point from the chunk sums, then scan only that chunk
+{
+	const int B = _batch;
+	QIndex chunk = _Chunk(), i;
+	Workspace::Frame f(_scratch);
+	QAccum *part = f.Get<QAccum>((_nStates / chunk + 1) * B);
+	std::vector<QIndex> result(B);
+	uint64_t first = _streams;
+	int s;
+
+	_streams += B;
+	QIndex chunks = _Sums(0, part);
+
+	#pragma omp parallel for schedule(static) if(B > 1 && _nStates * B > PAR_CHUNK)
+	for (s = 0; s < B; s++) {
+		QAccum total = 0.0;
+		QIndex c;
+		for (c = 0; c < chunks; c++) total += part[c * B + s];
+
+		PhiloxRandGenerator g = _rng.Split(first + s);
+		double rnd = g.Uniform() * total, x = 0.0;
+
+		for (c = 0; c < chunks - 1 && x + part[c * B + s] < rnd; c++)
+			x += part[c * B + s];
+
+		QIndex j = c * chunk, end = (c + 1) * chunk < _nStates ? (c + 1) * chunk : _nStates;
+		while ((x += norm(Amp(s, j))) < rnd && j < end - 1)
+			j++;
+		while (norm(Amp(s, j)) == 0 && j > 0)
+			j--;
+		result[s] = j;
+	}
+
+	#pragma omp parallel for schedule(static) if(_nStates * B > PAR_CHUNK)
+	for (i = 0; i < _nStates * B; i++)
+		_re[i] = _im[i] = 0;
+	for (s = 0; s < B; s++)
+		_re[result[s] * B + s] = 1;
+
+	return result;
+}
+
+std::vector<short> QStateBatch::Measure(int bit)
+{
+	const int B = _batch;
+	QIndex mask = (QIndex) 1 << bit, i;
+	Workspace::Frame f(_scratch);
+	QAccum *all = f.Get<QAccum>((_nStates / _Chunk() + 1) * B);
+	QAccum *set = f.Get<QAccum>((_nStates / _Chunk() + 1) * B);
+	QReal *scale[2] = { f.Get<QReal>(B), f.Get<QReal>(B) };
+	std::vector<short> result(B);
+	uint64_t first = _streams;
+	int s;
+
+	_streams += B;
+	QIndex chunks = _Sums(0, all);
+	_Sums(mask, set);
+
+	for (s = 0; s < B; s++) {
+		QAccum total = 0.0, p1 = 0.0;
+		for (QIndex c = 0; c < chunks; c++) {
+			total += all[c * B + s];
+			p1 += set[c * B + s];
+		}
+
+		PhiloxRandGenerator g = _rng.Split(first + s);
+		result[s] = g.Uniform() * total < p1;
+
+		QAccum p = result[s] ? p1 : total - p1;
+		scale[result[s]][s] = 1 / sqrt(p);
+		scale[!result[s]][s] = 0;
+	}
+
+	#pragma omp parallel for schedule(static) if(_nStates * B > PAR_CHUNK)
+	for (i = 0; i < _nStates; i++) {
+		const QReal *k = scale[(i & mask) != 0];
+		QReal *r = &_re[i * B], *im = &_im[i * B];
+		#pragma omp simd
+		for (int l = 0; l < B; l++) {
+			r[l] *= k[l];
+			im[l] *= k[l];
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,152 @@
+/* batch.h
+
+Many small registers simulated side by side
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+//! lib="Batches"
+
+/*
+
+A parameter sweep runs the same circuit on thousands of small
+registers. As separate QStates every one of them carries its own
+generator and every gate call its own setup, and a 12 qubit state is
+too small to spread over threads. A QStateBatch holds Batch() registers
+of the same size, interleaved: amplitude i of every register is stored
+next to amplitude i of all the others, real and imaginary parts in
+separate arrays. A gate then updates all registers in one pass, with
+the innermost loop running over the registers in SIMD lanes and the
+outer one over amplitude pairs on all threads:
+
+	QStateBatch b(12, 1000);				//1000 registers of 12 qubits
+	std::vector<RotQubit> ry;
+	for (int s = 0; s < 1000; s++)
+		ry.push_back(RotQubit(s * M_PI / 1000));
+
+	b.Apply(H, 0);								//the same gate everywhere
+	b.ApplyEach(ry, 1);						//a different angle in each
+	std::vector<QIndex> x = b.Measure();	//one outcome per register
+
+Measurements draw register s from stream s of one counter-based
+generator (see random.h), so the outcomes only depend on the seed and
+not on the number of threads.
+
+*/
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <vector>
+#include "qstate.h"
+#include "qop.h"
+#include "random.h"
+
+class QStateBatch
+//: Equally sized registers stored and updated together.
+{
+private:
+	std::vector<QReal> _re, _im;		//: amplitude i of register s at i*_batch+s
+	int _nQubits;							//: qubits per register
+	QIndex _nStates;						//: outcomes per register
+	int _batch;								//: number of registers
+	PhiloxRandGenerator _rng;			//: key for the per-register streams
+	uint64_t _streams;					//: streams used so far
+	Workspace _scratch;					//: gate matrices, partial sums
+
+	QIndex _Chunk() const;
+	QIndex _Sums(QIndex mask, QAccum *part) const;
+	void _Apply(QIndex mask, int bit, GateClass c, const QReal *m);
+	void _Gate(QIndex mask, int bit, GateClass c, const Complex a[4]);
+
+	template <class G>
+	void _Each(const std::vector<G> &g, QIndex mask, int bit)
+	{
+		assert((int) g.size() == _batch);
+		Workspace::Frame f(_scratch);
+		QReal *m = f.Get<QReal>(8 * _batch);	//re of a00..a11, then im
+		GateClass c = g[0].Shape();
+		Complex a[4];
+
+		for (int s = 0; s < _batch; s++) {
+			g[s].GetMatrix(a);
+			if (g[s].Shape() != c) c = GATE_GENERAL;
+			for (int k = 0; k < 4; k++) {
+				m[k * _batch + s] = real(a[k]);
+				m[(4 + k) * _batch + s] = imag(a[k]);
+			}
+		}
+		_Apply(mask, bit, c, m);
+	}
+
+public:
+	//: batch registers of size qubits, all in |00...0>.
+	// seed is the generator key (0 = from the clock).
+	QStateBatch(int qubits, int batch, uint64_t seed = 0);
+
+	//: Qubits per register.
+	int Qubits() const { return _nQubits; }
+
+	//: Outcomes per register.
+	QIndex Outcomes() const { return _nStates; }
+
+	//: Number of registers.
+	int Batch() const { return _batch; }
+
+	//: All registers to |00...0>.
+	void Reset();
+
+	//: Copy q into register s. (q must have Qubits() qubits)
+	void Set(int s, const QState &q);
+
+	//: Copy register s into q. (q must have Qubits() qubits)
+	void Get(int s, QState &q) const;
+
+	//: Amplitude of outcome i in register s.
+	Complex Amp(int s, QIndex i) const
+		{ return Complex(_re[i * _batch + s], _im[i * _batch + s]); }
+
+	//: Apply the same one-bit gate to every register.
+	void Apply(const SingleBit &g, int bit);
+
+	//: Apply the same controlled gate to every register.
+	void Apply(const Controlled &g, QIndex mask, int bit);
+
+	//: Apply g[s] to register s. (one gate per register)
+	template <class G>
+	void ApplyEach(const std::vector<G> &g, int bit)
+		{ _Each(g, 0, bit); }
+
+	//: Apply controlled gate g[s] to register s.
+	template <class G>
+	void ApplyEach(const std::vector<G> &g, QIndex mask, int bit)
+		{ _Each(g, mask, bit); }
+
+	//: Measure every register. [collapses them]
+	std::vector<QIndex> Measure();
+
+	//: Measure bit in every register. [collapses them]
+	std::vector<short> Measure(int bit);
+
+	//: Sum of normalized amplitudes of every register.
+	std::vector<double> Norms() const;
+};
+
+#endif
@@ -0,0 +1,504 @@
+/* circuit.cc
+
+Deferred gate lists with gate fusion
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include <algorithm>
+#include "circuit.h"
+#include "parallel.h"
+#include "kernel.h"
+#include "profile.h"
+
+//the gate bases only have protected constructors; these let the
+//circuit build a gate from a recorded matrix
+class AnyBit : public SingleBit
+{
+public:
+	AnyBit() { SetName("Fused", "CFused"); }
+};
+
+class AnyControlled : public Controlled
+{
+public:
+	AnyControlled() { SetName("Fused", "CFused"); }
+};
+
+QCircuit::QCircuit(int fuse, int tile)
+	: _compiled(false)
+{
+	SetFuse(fuse);
+	SetTile(tile);
+}
+
+void QCircuit::SetFuse(int fuse)
+{
+	if (fuse < 1) fuse = 1;
+	if (fuse > MAX_FUSE) fuse = MAX_FUSE;
+	_fuse = fuse;
+	_compiled = false;
+}
+
+void QCircuit::SetTile(int bits)
+{
+	if (bits > 0 && bits < MAX_FUSE) bits = MAX_FUSE;	//a block must fit
+	_tile = bits < 0 ? 0 : bits;
+}
+
+void QCircuit::Add(const SingleBit &g, int bit)
+{
+	Gate r;
+	r.mask = 0;
+	r.bit = bit;
+	g.GetMatrix(r.m);
+	r.shape = g.Shape();
+	_gates.push_back(r);
+	_compiled = false;
+}
+
+void QCircuit::Add(const Controlled &g, QIndex mask, int bit)
+{
+	assert(!(mask & ((QIndex) 1 << bit)));	//bit can't control itself
+	Gate r;
+	r.mask = mask;
+	r.bit = bit;
+	g.GetMatrix(r.m);
+	r.shape = g.Shape();
+	_gates.push_back(r);
+	_compiled = false;
+}
+
+void QCircuit::Clear()
+{
+	_gates.clear();
+	_blocks.clear();
+	_compiled = false;
+}
+
+int QCircuit::Blocks()
+{
+	if (!_compiled) _Compile();
+	return _blocks.size();
+}
+
+void QCircuit::_Compile()
+//Open blocks act on disjoint bits, so they commute with each other and
+//can be closed in any order. A gate that overlaps some of them either
+//merges with all of those, or closes them and starts over; a gate
+//overlapping none joins the first block with room, so runs of gates on
+//different bits (e.g. a Walsh-Hadamard) are fused as well.
+{
+	std::vector<Block> open;
+	size_t i, j;
+
+	_blocks.clear();
+
+	for (int g = 0; g < (int) _gates.size(); g++) {
+		QIndex touch = _gates[g].mask | ((QIndex) 1 << _gates[g].bit);
+		QIndex all = touch;
+		bool overlap = false;
+
+		for (i = 0; i < open.size(); i++)
+			if (open[i].qubits & touch) {
+				all |= open[i].qubits;
+				overlap = true;
+			}
+
+		if (count_ones(all) <= _fuse) {
+			if (!overlap) {
+				for (i = 0; i < open.size(); i++)
+					if (count_ones(open[i].qubits | touch) <= _fuse) break;
+				if (i < open.size()) {
+					open[i].qubits |= touch;
+					open[i].gates.push_back(g);
+					continue;
+				}
+			}
+
+			Block b;
+			b.qubits = all;
+			for (i = 0; i < open.size(); )
+				if (open[i].qubits & touch) {
+					b.gates.insert(b.gates.end(), open[i].gates.begin(),
+										open[i].gates.end());
+					open.erase(open.begin() + i);
+				} else i++;
+			b.gates.push_back(g);
+			open.push_back(b);
+			continue;
+		}
+
+		//too wide to merge: close everything in the way
+		for (i = 0; i < open.size(); )
+			if (open[i].qubits & touch) {
+				_blocks.push_back(open[i]);
+				open.erase(open.begin() + i);
+			} else i++;
+
+		Block b;
+		b.qubits = touch;
+		b.gates.push_back(g);
+		if (count_ones(touch) > _fuse)
+			_blocks.push_back(b);			//applied on its own
+		else
+			open.push_back(b);
+	}
+	_blocks.insert(_blocks.end(), open.begin(), open.end());
+
+	for (j = 0; j < _blocks.size(); j++)
+		if (_blocks[j].gates.size() > 1)
+			_Fuse(_blocks[j]);
+
+	D("Fused %d gates into %d blocks\n", (int) _gates.size(),
+	  (int) _blocks.size());
+	_compiled = true;
+}
+
+void QCircuit::_Fuse(Block &b) const
+//multiply the gates of a block into one matrix over its own bits, the
+//lowest block bit being bit 0 of the row/column index
+{
+	int bits[MAX_FUSE];
+	int k = 0, dim, i, r, col;
+
+	for (i = 0; k < count_ones(b.qubits); i++)
+		if (b.qubits & ((QIndex) 1 << i)) bits[k++] = i;
+	dim = 1 << k;
+
+	b.m.assign(dim * dim, Complex(0));
+	for (r = 0; r < dim; r++)
+		b.m[r * dim + r] = 1;
+
+	for (size_t g = 0; g < b.gates.size(); g++) {
+		const Gate &gt = _gates[b.gates[g]];
+		int t = 0, cm = 0;
+
+		for (i = 0; i < k; i++) {		//gate bits in block coordinates
+			if (bits[i] == gt.bit) t = 1 << i;
+			if (gt.mask & ((QIndex) 1 << bits[i])) cm |= 1 << i;
+		}
+
+		for (r = 0; r < dim; r++) {
+			if ((r & t) || (r & cm) != cm) continue;
+			Complex *x0 = &b.m[r * dim], *x1 = &b.m[(r | t) * dim];
+			for (col = 0; col < dim; col++) {
+				Complex a0 = x0[col], a1 = x1[col];
+				x0[col] = gt.m[0] * a0 + gt.m[1] * a1;
+				x1[col] = gt.m[2] * a0 + gt.m[3] * a1;
+			}
+		}
+	}
+}
+
+QIndex QCircuit::_Needs(const Block &b) const
+//bits a block must find below the tile size: a lone gate only needs its
+//controlled bit, a fused block needs all of them
+{
+	if (b.gates.size() == 1)
+		return (QIndex) 1 << _gates[b.gates[0]].bit;
+	return b.qubits;
+}
+
+void QCircuit::_Place(const Block &b, const int *phys, Step &s) const
+//translate a block to physical bit positions; phys[i] is where qubit
+//i currently is
+{
+	int i, j;
+
+	if (count_ones(b.qubits) == 1 || b.gates.size() == 1) {
+		s.dense = false;
+		s.mask = 0;
+		if (b.gates.size() == 1) {
+			const Gate &g = _gates[b.gates[0]];
+			for (i = 0; (g.mask >> i) != 0; i++)
+				if (g.mask & ((QIndex) 1 << i)) s.mask |= (QIndex) 1 << phys[i];
+			s.bit = phys[g.bit];
+			s.shape = g.shape;
+			for (i = 0; i < 4; i++) s.m[i] = g.m[i];
+			return;
+		}
+
+		for (i = 0; !(b.qubits & ((QIndex) 1 << i)); i++) ;
+		s.bit = phys[i];
+		for (i = 0; i < 4; i++) s.m[i] = b.m[i];
+		s.shape = GATE_GENERAL;
+		if (s.m[1] == Complex(0) && s.m[2] == Complex(0))
+			s.shape = GATE_DIAGONAL;
+		else if (s.m[0] == Complex(0) && s.m[3] == Complex(0))
+			s.shape = GATE_ANTIDIAGONAL;
+		return;
+	}
+
+	//matrix row/column bit j belongs to the j-th lowest qubit of the block
+	s.dense = true;
+	s.k = 0;
+	for (i = 0; s.k < count_ones(b.qubits); i++)
+		if (b.qubits & ((QIndex) 1 << i)) s.bits[s.k++] = phys[i];
+
+	int dim = 1 << s.k;
+	for (i = 0; i < dim; i++) {
+		s.offs[i] = 0;
+		for (j = 0; j < s.k; j++)
+			if (i & (1 << j)) s.offs[i] |= (QIndex) 1 << s.bits[j];
+	}
+	std::sort(s.bits, s.bits + s.k);
+
+	//split into real and imaginary parts, column by column
+	s.mr.resize(dim * dim);
+	s.mi.resize(dim * dim);
+	for (i = 0; i < dim * dim; i++) {
+		s.mr[i] = real(b.m[(i % dim) * dim + i / dim]);
+		s.mi[i] = imag(b.m[(i % dim) * dim + i / dim]);
+	}
+}
+
+void QCircuit::_ApplyGate(QState &q, const Gate &g) const
+{
+	if (g.mask) {
+		AnyControlled op;
+		op.SetMatrix(g.m[0], g.m[1], g.m[2], g.m[3], g.shape);
+		op(q, g.mask, g.bit);
+	} else {
+		AnyBit op;
+		op.SetMatrix(g.m[0], g.m[1], g.m[2], g.m[3], g.shape);
+		op(q, g.bit);
+	}
+}
+
+void QCircuit::_DenseRange(Complex *a, QIndex p, QIndex end, const Step &s)
+//multiply groups p..end-1 of 2^k amplitudes, those that differ only in
+//the block bits, by the block matrix
+{
+	const QReal *mr = &s.mr[0], *mi = &s.mi[0];
+	int dim = 1 << s.k;
+
+	for ( ; p < end; p++) {
+		QIndex base = p;
+		for (int j = 0; j < s.k; j++) {		//open a zero at each block bit
+			QIndex low = ((QIndex) 1 << s.bits[j]) - 1;
+			base = ((base & ~low) << 1) | (base & low);
+		}
+		ApplyMatrix(a + base, s.offs, dim, mr, mi);
+	}
+}
+
+void QCircuit::_ApplyStep(QState &q, const Step &s) const
+//apply a placed block to the whole state in one sweep
+{
+	if (!s.dense) {
+		Gate g;
+		g.mask = s.mask;
+		g.bit = s.bit;
+		g.shape = s.shape;
+		for (int i = 0; i < 4; i++) g.m[i] = s.m[i];
+		_ApplyGate(q, g);
+		return;
+	}
+
+	PROFILE("CircuitBlock", 2.0 * sizeof(Complex) * q.Outcomes());
+	Complex *a = &q[0];
+	QIndex groups = q.Outcomes() >> s.k;
+	QIndex chunks = (groups + PAR_CHUNK - 1) / PAR_CHUNK;
+	QIndex c;
+
+	#pragma omp parallel for schedule(static) if(chunks > 1)
+	for (c = 0; c < chunks; c++) {
+		QIndex end = (groups - c * PAR_CHUNK < PAR_CHUNK) ? groups
+																		  : (c + 1) * PAR_CHUNK;
+		_DenseRange(a, c * PAR_CHUNK, end, s);
+	}
+}
+
+void QCircuit::_StepTile(Complex *a, int nbits, QIndex base, const Step &s)
+//apply a placed block to the tile of 2^nbits amplitudes starting at
+//outcome base; controlling bits above the tile are the same for all of
+//it, so they either hold for the whole tile or for none of it
+{
+	if (s.dense) {
+		_DenseRange(a, 0, (QIndex) 1 << (nbits - s.k), s);
+		return;
+	}
+
+	QIndex low  = ((QIndex) 1 << nbits) - 1;
+	QIndex high = s.mask & ~low;
+	if ((base & high) == high)
+		ApplyGate(a, nbits, s.mask & low, s.bit, s.shape, s.m);
+}
+
+//blocks looked at when deciding whether to swap a high qubit in
+static const size_t SWAP_LOOKAHEAD = 8;
+
+static void SwapBits(Complex *a, int nbits, int x, int y)
+//exchange qubits x and y of a dense state
+{
+	if (x > y) { int t = x; x = y; y = t; }
+	PROFILE("SwapBits", sizeof(Complex) * ((QIndex) 1 << nbits));	//half move
+
+	QIndex mx = (QIndex) 1 << x, my = (QIndex) 1 << y;
+	QIndex groups = (QIndex) 1 << (nbits - 2);
+	QIndex chunks = (groups + PAR_CHUNK - 1) / PAR_CHUNK;
+	QIndex c;
+
+	#pragma omp parallel for schedule(static) if(chunks > 1)
+	for (c = 0; c < chunks; c++) {
+		QIndex end = (groups - c * PAR_CHUNK < PAR_CHUNK) ? groups
+																		  : (c + 1) * PAR_CHUNK;
+		for (QIndex p = c * PAR_CHUNK; p < end; p++) {
+			QIndex k = ((p & ~(mx - 1)) << 1) | (p & (mx - 1));
+			k = ((k & ~(my - 1)) << 1) | (k & (my - 1));
+			Complex t = a[k | mx];
+			a[k | mx] = a[k | my];
+			a[k | my] = t;
+		}
+	}
+}
+
+int QCircuit::_Victim(size_t from, QIndex need,
+							 const std::vector<int> &logic) const
+//low position to give up for a high qubit: the one whose qubit is
+//needed low again furthest in the future (or never)
+{
+	int best = -1;
+	size_t bestuse = 0;
+
+	for (int v = 0; v < _tile; v++) {
+		if (need & ((QIndex) 1 << logic[v])) continue;
+
+		QIndex mask = (QIndex) 1 << logic[v];
+		size_t use;
+		for (use = from; use < _blocks.size(); use++)
+			if (_Needs(_blocks[use]) & mask) break;
+
+		if (best < 0 || use > bestuse) {
+			best = v;
+			bestuse = use;
+		}
+	}
+	return best;
+}
+
+void QCircuit::_RunTiled(QState &q)
+{
+	int n = q.Qubits(), l, p;
+	std::vector<int> phys(n), logic(n);		//qubit -> position and back
+	std::vector<Step> stage;
+	size_t i = 0, j, st;
+
+	for (l = 0; l < n; l++)
+		phys[l] = logic[l] = l;
+
+	Complex *a = &q[0];
+	QIndex tiles = q.Outcomes() >> _tile;
+	QIndex t;
+
+	while (i < _blocks.size()) {
+		QIndex need = _Needs(_blocks[i]);
+
+		//a swap costs a sweep, so it only pays off if the high qubit is
+		//needed again soon; otherwise the block is applied directly
+		QIndex high = 0, again = 0;
+		for (l = 0; l < n; l++)
+			if ((need & ((QIndex) 1 << l)) && phys[l] >= _tile)
+				high |= (QIndex) 1 << l;
+		for (j = i + 1; j < _blocks.size() && j <= i + SWAP_LOOKAHEAD; j++)
+			again |= _Needs(_blocks[j]) & high;
+		if (again != high) {
+			Step s;
+			_Place(_blocks[i], &phys[0], s);
+			_ApplyStep(q, s);
+			i++;
+			continue;
+		}
+
+		for (l = 0; l < n; l++)
+			if ((need & ((QIndex) 1 << l)) && phys[l] >= _tile) {
+				int v = _Victim(i + 1, need, logic);
+				D("Swapping qubit %d (at %d) with %d\n", l, phys[l], v);
+				SwapBits(a, n, phys[l], v);
+				logic[phys[l]] = logic[v];
+				phys[logic[v]] = phys[l];
+				logic[v] = l;
+				phys[l] = v;
+			}
+
+		//every block that can now run inside a tile
+		stage.clear();
+		for (j = i; j < _blocks.size(); j++) {
+			need = _Needs(_blocks[j]);
+			for (l = 0; l < n; l++)
+				if ((need & ((QIndex) 1 << l)) && phys[l] >= _tile) break;
+			if (l < n) break;
+			stage.push_back(Step());
+			_Place(_blocks[j], &phys[0], stage.back());
+		}
+
+		{
+			PROFILE("CircuitTiles", 2.0 * sizeof(Complex) * q.Outcomes());
+
+			#pragma omp parallel for schedule(static) if(tiles > 1)
+			for (t = 0; t < tiles; t++)
+				for (st = 0; st < stage.size(); st++)
+					_StepTile(a + (t << _tile), _tile, t << _tile, stage[st]);
+		}
+		i = j;
+	}
+
+	//back to the usual bit order
+	for (p = 0; p < n; p++)
+		if (logic[p] != p) {
+			int x = phys[p], lp = logic[p];
+			SwapBits(a, n, p, x);
+			logic[x] = lp;
+			phys[lp] = x;
+			logic[p] = phys[p] = p;
+		}
+}
+
+void QCircuit::operator() (QState &q)
+{
+	if (!_compiled) _Compile();
+
+	if (_tile && !q.IsSparse() && q.Qubits() > _tile) {
+		for (size_t j = 0; j < _blocks.size(); j++)
+			assert(_blocks[j].qubits < q.Outcomes());
+		_RunTiled(q);
+		return;
+	}
+
+	std::vector<int> phys(q.Qubits());
+	for (int l = 0; l < q.Qubits(); l++)
+		phys[l] = l;
+
+	for (size_t j = 0; j < _blocks.size(); j++) {
+		const Block &b = _blocks[j];
+		assert(b.qubits < q.Outcomes());
+
+		if (q.IsSparse())
+			for (size_t g = 0; g < b.gates.size(); g++)
+				_ApplyGate(q, _gates[b.gates[g]]);
+		else {
+			Step s;
+			_Place(b, &phys[0], s);
+			_ApplyStep(q, s);
+		}
+	}
+}
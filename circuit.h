@@ -0,0 +1,163 @@
+/* circuit.h
+
+Deferred gate lists with gate fusion
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+//! lib="Quantum Circuits"
+
+/*
+
+Every gate in qop.h sweeps the whole state when it is applied, so a
+RotQubit, a RotPhase and a Hadamard on the same bit cost three passes
+over memory. A QCircuit only records gates; when it is run on a state
+the gates are first grouped into blocks acting on at most Fuse() qubits
+and each block is applied in one sweep:
+
+	QCircuit c;
+	RotQubit Ry(M_PI/3);
+	Hadamard H;
+	CNot     CN;
+
+	c.Add(Ry, 0);
+	c.Add(H, 0);				//fused with Ry into one 2x2 matrix
+	c.Add(CN, 1, 2);			//bits 0..2 form one 8x8 block
+	c(mystate);
+
+Gates on disjoint bits commute, so any number of blocks can be open at
+once; a gate joins the block(s) it overlaps as long as the union stays
+within Fuse() qubits, otherwise those blocks are closed and it starts a
+new one. A block with a single gate is applied by that gate's own
+kernel, one-bit blocks by the SingleBit kernel and everything else as a
+dense 2^k x 2^k matrix. Sparse states are updated gate by gate, since
+their cost is in the nonzero amplitudes and not in sweeps.
+
+The circuit keeps its gates after running, so it can be applied to
+any number of states; the blocks are only recomputed after Add().
+
+States larger than one tile of 2^Tile() amplitudes (about L2 sized)
+are run tile by tile: consecutive blocks acting only on bits below
+Tile() are applied to one tile after the other, so the state is read
+from memory once per such run of blocks and not once per block.
+Controlling bits may be anywhere, as they are constant inside a tile.
+A block that needs a higher bit first has that bit swapped with a low
+one (the low bit needed again furthest in the future); the circuit
+keeps track of where each qubit is and swaps everything back at the
+end, so the state is left in its usual bit order.
+
+*/
+
+#ifndef _CIRCUIT_H_
+#define _CIRCUIT_H_
+
+#include <vector>
+#include "qstate.h"
+#include "qop.h"
+
+//: Largest block (in qubits) gates are fused into.
+static const int MAX_FUSE = 5;
+
+//: Default tile size in qubits. (2^14 double amplitudes = 256kB)
+static const int TILE_BITS = 14;
+
+class QCircuit
+//: Recorded sequence of gates, applied as fused blocks.
+{
+private:
+	struct Gate {
+		QIndex mask;						//controlling bits (0 for one-bit gates)
+		int bit;								//controlled bit
+		Complex m[4];						//2x2 matrix, row by row
+		GateClass shape;
+	};
+
+	struct Block {
+		QIndex qubits;						//bits the block acts on
+		std::vector<int> gates;			//indices into _gates, in order
+		std::vector<Complex> m;			//fused matrix (if more than one gate)
+	};
+
+	struct Step {							//a block placed on physical bits
+		bool dense;							//2^k matrix, else a 2x2 gate
+		QIndex mask;						//gate: controlling bits
+		int bit;								//gate: controlled bit
+		GateClass shape;
+		Complex m[4];
+		int k;								//dense: bits, in ascending order
+		int bits[MAX_FUSE];
+		QIndex offs[1 << MAX_FUSE];	//dense: offset of each matrix row
+		std::vector<QReal> mr, mi;		//dense: matrix columns, re and im
+	};
+
+	std::vector<Gate> _gates;
+	std::vector<Block> _blocks;
+	int _fuse;								//: max qubits per block
+	int _tile;								//: tile size in qubits, 0 = off
+	bool _compiled;						//: _blocks match _gates
+
+	void _Compile();
+	void _Fuse(Block &b) const;
+	void _Place(const Block &b, const int *phys, Step &s) const;
+	QIndex _Needs(const Block &b) const;
+	void _ApplyGate(QState &q, const Gate &g) const;
+	void _ApplyStep(QState &q, const Step &s) const;
+	int  _Victim(size_t from, QIndex need, const std::vector<int> &logic) const;
+	void _RunTiled(QState &q);
+
+	static void _DenseRange(Complex *a, QIndex p, QIndex end, const Step &s);
+	static void _StepTile(Complex *a, int nbits, QIndex base, const Step &s);
+
+public:
+	//: Create an empty circuit fusing up to fuse qubits per block.
+	QCircuit(int fuse = 4, int tile = TILE_BITS);
+
+	//: Record a one-bit gate on bit.
+	void Add(const SingleBit &g, int bit);
+
+	//: Record a controlled gate (controls given as a mask).
+	void Add(const Controlled &g, QIndex mask, int bit);
+
+	//: Apply all recorded gates to q.
+	void operator() (QState &q);
+
+	//: Forget all recorded gates.
+	void Clear();
+
+	//: Number of recorded gates.
+	int Gates() const { return _gates.size(); }
+
+	//: Number of sweeps the circuit is fused into.
+	int Blocks();
+
+	//: Max qubits per block.
+	int Fuse() const { return _fuse; }
+
+	//: Change the block size. (1 = fuse one-bit gates only)
+	void SetFuse(int fuse);
+
+	//: Tile size in qubits. (0 if tiled execution is off)
+	int Tile() const { return _tile; }
+
+	//: Change the tile size; 0 applies every block to the whole state.
+	void SetTile(int bits);
+};
+
+#endif
@@ -27,5 +27,23 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <complex>
 #define abs2 norm
 
+//amplitudes are stored in double precision by default. Compile with
+//-DQ_SINGLE to store them as floats, which halves the memory of a
+//state and doubles the width of the vector kernels. Sums over the
+//state (norms, measurement probabilities) are still accumulated in
+//QAccum, i.e. double, unless -DQ_SINGLE_ACCUM is given as well.
+
+#ifdef Q_SINGLE
+typedef float	QReal;
+#else
+typedef double	QReal;
+#endif
+
+#ifdef Q_SINGLE_ACCUM
+typedef float	QAccum;
+#else
+typedef double	QAccum;
+#endif
+
 //: For backward compatibility and notation ease.
-typedef complex<double>  Complex;
+typedef complex<QReal>  Complex;
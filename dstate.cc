@@ -0,0 +1,330 @@
+/* dstate.cc
+
+Quantum register distributed over several processes
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include <string.h>
+#include "dstate.h"
+
+static int GlobalBits(const QTransport &net)
+{
+	int g = 0;
+	while ((1 << g) < net.Size()) g++;
+	assert((1 << g) == net.Size());		//a power of two
+	return g;
+}
+
+QDistState::QDistState(int size, QTransport &net)
+	: _net(&net), _nQubits(size), _nLocal(size - GlobalBits(net)),
+	  _base((QIndex) net.Rank() << _nLocal)
+{
+	assert(_nLocal >= 1);
+	_local.assign((QIndex) 1 << _nLocal, Complex(0));
+	if (_base == 0) _local[0] = 1;
+}
+
+QDistState::QDistState(const QState &q, QTransport &net)
+	: _net(&net), _nQubits(q.Qubits()), _nLocal(q.Qubits() - GlobalBits(net)),
+	  _base((QIndex) net.Rank() << _nLocal)
+{
+	assert(_nLocal >= 1);
+	_local.resize((QIndex) 1 << _nLocal);
+	for (QIndex i = 0; i < (QIndex) _local.size(); i++)
+		_local[i] = q.Amp(_base + i);
+}
+
+double QDistState::_Sum(double mine) const
+//every process' value, added in rank order
+{
+	std::vector<double> all(_net->Size());
+	_net->Gather(&mine, 1, &all[0]);
+
+	double total = 0.0;
+	for (int r = 0; r < _net->Size(); r++)
+		total += all[r];
+	return total;
+}
+
+double QDistState::_Draw()
+//uniform number in [0,1) drawn by process 0
+{
+	double u = 0.0;
+	if (_net->Rank() == 0) u = _rng.Uniform();
+	_net->Broadcast(&u, sizeof(u), 0);
+	return u;
+}
+
+QAccum QDistState::_LocalNorm(QIndex mask, QIndex value) const
+//probability of the local outcomes i with (i & mask) == value, summed
+//chunk by chunk as in QState
+{
+	QIndex n = _local.size(), chunks = (n + PAR_CHUNK - 1) / PAR_CHUNK, c;
+	std::vector<QAccum> part(chunks);
+
+	#pragma omp parallel for schedule(static) if(chunks > 1)
+	for (c = 0; c < chunks; c++) {
+		QIndex end = (c + 1) * PAR_CHUNK < n ? (c + 1) * PAR_CHUNK : n;
+		QAccum p = 0.0;
+		for (QIndex i = c * PAR_CHUNK; i < end; i++)
+			if ((i & mask) == value) p += norm(_local[i]);
+		part[c] = p;
+	}
+
+	QAccum total = 0.0;
+	for (c = 0; c < chunks; c++)
+		total += part[c];
+	return total;
+}
+
+void QDistState::Apply(const SingleBit &g, int bit)
+{
+	Complex m[4];
+	g.GetMatrix(m);
+	_Apply(0, bit, g.Shape(), m);
+}
+
+void QDistState::Apply(const Controlled &g, QIndex mask, int bit)
+{
+	Complex m[4];
+	g.GetMatrix(m);
+	_Apply(mask, bit, g.Shape(), m);
+}
+
+void QDistState::_Apply(QIndex mask, int bit, GateClass c, const Complex m[4])
+{
+	assert(0 <= bit && bit < _nQubits);
+	mask &= ~((QIndex) 1 << bit);
+
+	//global controls: the whole part takes part or none of it does
+	QIndex global = mask & ~(((QIndex) 1 << _nLocal) - 1);
+	if ((_base & global) != global) return;
+	mask &= ~global;
+
+	if (bit < _nLocal)
+		_ApplyLocal(mask, bit, c, m);
+	else
+		_ApplyGlobal(mask, bit, c, m);
+}
+
+void QDistState::_ApplyLocal(QIndex mask, int bit, GateClass c,
+									  const Complex m[4])
+//the part is cut into blocks of 2^b amplitudes that hold both halves
+//of every pair, so the blocks can go to different threads
+{
+	int b = (_nLocal < 14) ? _nLocal : 14;		//PAR_CHUNK amplitudes
+	if (b < bit + 1) b = bit + 1;
+
+	QIndex inner  = mask & (((QIndex) 1 << b) - 1);
+	QIndex outer  = mask & ~inner;
+	QIndex blocks = (QIndex) 1 << (_nLocal - b), k;
+
+	#pragma omp parallel for schedule(static) if(blocks > 1)
+	for (k = 0; k < blocks; k++) {
+		QIndex off = k << b;
+		if ((off & outer) == outer)
+			ApplyGate(&_local[off], b, inner, bit, c, m);
+	}
+}
+
+void QDistState::_ApplyGlobal(QIndex mask, int bit, GateClass c,
+										const Complex m[4])
+//this process holds one half of every pair (the upper one if its
+//rank has the bit set), the partner the other, at the same offsets
+{
+	int partner = _net->Rank() ^ (1 << (bit - _nLocal));
+	bool upper  = _net->Rank() & (1 << (bit - _nLocal));
+	Complex mine  = upper ? m[3] : m[0];		//new = mine*ours + other*theirs
+	Complex other = upper ? m[2] : m[1];
+	QIndex n = _local.size(), i;
+
+	if (c == GATE_DIAGONAL) {
+		#pragma omp parallel for schedule(static) if(n > PAR_CHUNK)
+		for (i = 0; i < n; i++)
+			if ((i & mask) == mask) _local[i] *= mine;
+		return;
+	}
+
+	QIndex piece = n < DIST_CHUNK ? n : DIST_CHUNK;
+	Workspace::Frame f(_scratch);
+	Complex *theirs = f.Get<Complex>(piece);
+
+	for (QIndex off = 0; off < n; off += piece) {
+		QIndex len = (n - off < piece) ? n - off : piece;
+		Complex *a = &_local[off];
+
+		_net->Exchange(partner, a, theirs, len * sizeof(Complex));
+
+		#pragma omp parallel for schedule(static) if(len > PAR_CHUNK)
+		for (i = 0; i < len; i++)
+			if (((off + i) & mask) == mask)
+				a[i] = mine * a[i] + other * theirs[i];
+	}
+}
+
+void QDistState::ModExp(QIndex a, QIndex n, int b)
+//the same swaps as ModExp::operator(): x < 2^b trades places with
+//y = x + (a^x mod n << b). Each process finds the pairs it holds an
+//end of from either side; pairs held entirely here are swapped in
+//place, for the others the amplitude is sent to the process holding
+//the other end, which sends its own back.
+{
+	struct Move { QIndex at; Complex v; };
+
+	int size = _net->Size(), rank = _net->Rank();
+	QIndex first = ((QIndex) 1 << b) - 1;		//mask of the first register
+	QIndex local = _local.size(), i, f = 0;
+	std::vector< std::vector<char> > out(size);
+
+	for (i = 0; i < local; i++) {
+		QIndex x = (_base + i) & first;
+		f = (i == 0 || x == 0) ? modexp(a, x, n) : mulmod(f, a, n);
+
+		Move mv;
+		if (_base + i <= first) {				//x side
+			if (f == 0) continue;
+			mv.at = x + (f << b);
+		} else {										//y side
+			if (((_base + i) >> b) != f) continue;
+			mv.at = x;
+		}
+
+		int owner = mv.at >> _nLocal;
+		if (owner == rank) {
+			if (_base + i <= first) std::swap(_local[i], _local[mv.at - _base]);
+			continue;
+		}
+		mv.v = _local[i];
+		out[owner].insert(out[owner].end(), (char *) &mv, (char *) (&mv + 1));
+	}
+
+	//pair process r with r^d in round d, so everyone is busy each round
+	std::vector<char> in;
+	for (int d = 1; d < size; d++) {
+		int peer = rank ^ d;
+		_net->ExchangeList(peer, out[peer], in);
+		std::vector<char>().swap(out[peer]);
+
+		const Move *mv = (const Move *) (in.empty() ? NULL : &in[0]);
+		for (size_t k = 0; k < in.size() / sizeof(Move); k++)
+			_local[mv[k].at - _base] = mv[k].v;
+	}
+}
+
+void QDistState::Collect(std::vector<Complex> &all) const
+{
+	QIndex n = _local.size();
+	std::vector<Complex> scratch(n < DIST_CHUNK ? n : DIST_CHUNK);
+
+	all.clear();
+	if (_net->Rank() == 0) {
+		all.resize(Outcomes());
+		memcpy(&all[0], &_local[0], n * sizeof(Complex));
+	}
+
+	//process 0 takes one piece from each in turn (and sends back junk)
+	for (int r = 1; r < _net->Size(); r++)
+		for (QIndex off = 0; off < n; off += scratch.size()) {
+			QIndex len = (n - off < (QIndex) scratch.size()) ? n - off : scratch.size();
+			if (_net->Rank() == 0)
+				_net->Exchange(r, &scratch[0], &all[(QIndex) r * n + off],
+									len * sizeof(Complex));
+			else if (_net->Rank() == r)
+				_net->Exchange(0, &_local[off], &scratch[0], len * sizeof(Complex));
+		}
+}
+
+QIndex Measure(QDistState &q)
+{
+	int size = q._net->Size(), rank = q._net->Rank(), r;
+	double mine = q._LocalNorm(0, 0);
+	std::vector<double> part(size);
+
+	q._net->Gather(&mine, 1, &part[0]);
+
+	double total = 0.0;
+	for (r = 0; r < size; r++) total += part[r];
+	double rnd = q._Draw() * total;
+
+	//the process holding the random point; skip empty ones at the end
+	double x = 0.0;
+	for (r = 0; r < size - 1 && x + part[r] < rnd; r++)
+		x += part[r];
+	while (part[r] == 0 && r > 0)
+		x -= part[--r];
+
+	int64_t result = 0;
+	if (rank == r) {
+		QIndex i = 0, n = q._local.size();
+		while ((x += norm(q._local[i])) < rnd && i < n - 1)
+			i++;
+		while (norm(q._local[i]) == 0 && i > 0)
+			i--;
+		result = q._base + i;
+	}
+	q._net->Broadcast(&result, sizeof(result), r);
+	D("Set distributed register state to %lld\n", (QIndex) result);
+
+	std::fill(q._local.begin(), q._local.end(), Complex(0));
+	if (rank == r) q._local[result - q._base] = 1;
+	return result;
+}
+
+short Measure(QDistState &q, int i)
+{
+	int size = q._net->Size();
+	QIndex bit = (QIndex) 1 << i, n = q._local.size(), j;
+	double mine[2];
+	std::vector<double> part(2 * size);
+
+	mine[0] = q._LocalNorm(0, 0);
+	if (i >= q._nLocal)
+		mine[1] = (q._base & bit) ? mine[0] : 0.0;
+	else
+		mine[1] = q._LocalNorm(bit, bit);
+	q._net->Gather(mine, 2, &part[0]);
+
+	double total = 0.0, p1 = 0.0;
+	for (int r = 0; r < size; r++) {
+		total += part[2 * r];
+		p1 += part[2 * r + 1];
+	}
+
+	short result = q._Draw() * total < p1;
+	double p = result ? p1 : total - p1;
+	QReal scale = 1 / sqrt(p);
+	D("Measured bit %d as %d\n", i, result);
+
+	#pragma omp parallel for schedule(static) if(n > PAR_CHUNK)
+	for (j = 0; j < n; j++)
+		if ((((q._base + j) & bit) != 0) == result)
+			q._local[j] *= scale;
+		else
+			q._local[j] = 0;
+
+	return result;
+}
+
+double norm(const QDistState &q)
+{
+	return q._Sum(q._LocalNorm(0, 0));
+}
@@ -0,0 +1,137 @@
+/* dstate.h
+
+Quantum register distributed over several processes
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+//! lib="Distributed States"
+
+/*
+
+One machine's memory ends at about 33 qubits of double amplitudes. A
+QDistState splits the amplitude array over the 2^g processes of a
+QTransport (see transport.h): process r holds the outcomes whose top g
+bits are r. The low LocalQubits() bits are local and the top g global.
+
+	ShmTransport net(4);
+	QDistState q(24, net);			//2^22 amplitudes per process
+	Hadamard H;
+
+	q.Apply(H, 3);						//local: no communication
+	q.Apply(H, 23);					//global: exchanged with process r^2
+	QIndex x = Measure(q);			//same result on every process
+
+A gate on a local bit runs on each process' part alone; global control
+bits just decide whether a process takes part. A gate on a global bit
+pairs every process with the one differing in that bit; the two swap
+their amplitudes DIST_CHUNK at a time and each computes its own half
+of the result. Diagonal gates on global bits need no communication.
+
+Measurements and norm() sum each process' part and add the parts in
+rank order, so every process gets the same, reproducible, numbers; the
+random draw is made on process 0 and broadcast. ModExp moves each
+amplitude to the process that owns its new outcome.
+
+*/
+
+#ifndef _DSTATE_H_
+#define _DSTATE_H_
+
+#include <vector>
+#include "qstate.h"
+#include "qop.h"
+#include "transport.h"
+
+//: Amplitudes exchanged per step for a gate on a global bit.
+static const int DIST_CHUNK = 1 << 16;
+
+class QDistState
+//: Quantum register split over the processes of a QTransport.
+{
+private:
+	std::vector<Complex> _local;		//: outcomes Base().. of this process
+	QTransport *_net;
+	int _nQubits;							//: number of qubits
+	int _nLocal;							//: bits below this are local
+	QIndex _base;							//: first outcome held here
+	PhiloxRandGenerator _rng;			//: draws, on process 0 only
+	Workspace _scratch;					//: the partner's amplitudes
+
+	double _Sum(double mine) const;
+	double _Draw();
+	QAccum _LocalNorm(QIndex mask, QIndex value) const;
+	void _Apply(QIndex mask, int bit, GateClass c, const Complex m[4]);
+	void _ApplyLocal(QIndex mask, int bit, GateClass c, const Complex m[4]);
+	void _ApplyGlobal(QIndex mask, int bit, GateClass c, const Complex m[4]);
+
+public:
+	//: Base state |00...0> of size qubits.
+	// The number of processes must be a power of two, at most 2^(size-1).
+	QDistState(int size, QTransport &net);
+
+	//: This process' part of q. (every process passes the same state)
+	// With a ShmTransport, build q after the transport: a large q built
+	// before it has started OpenMP, and the forked processes then run
+	// on one thread each (see transport.h).
+	QDistState(const QState &q, QTransport &net);
+
+	//: Returns total number of outcomes.
+	QIndex Outcomes() const { return (QIndex) 1 << _nQubits; }
+
+	//: Returns total number of bits.
+	int Qubits() const { return _nQubits; }
+
+	//: Bits held within each process.
+	int LocalQubits() const { return _nLocal; }
+
+	//: First outcome held by this process.
+	QIndex Base() const { return _base; }
+
+	//: This process' amplitudes, for outcomes Base() and up.
+	Complex *Local() { return &_local[0]; }
+
+	//: Make measurements reproducible. (call on every process)
+	void Seed(unsigned int seedVal, unsigned int seedVal2 = 0)
+		{ _rng.Seed(seedVal, seedVal2); }
+
+	//: Apply a one-bit gate.
+	void Apply(const SingleBit &g, int bit);
+
+	//: Apply a controlled gate. (controls given as a mask)
+	void Apply(const Controlled &g, QIndex mask, int bit);
+
+	//: Modular exponentiation, as ModExp in qop.h.
+	void ModExp(QIndex a, QIndex n, int b);
+
+	//: Whole state on process 0. (all is left empty on the others)
+	void Collect(std::vector<Complex> &all) const;
+
+	//: Destructive register measure.
+	friend QIndex Measure(QDistState &q);
+
+	//: Destructive bit measure.
+	friend short Measure(QDistState &q, int i);
+
+	//: Sum of normalized amplitudes.
+	friend double norm(const QDistState &q);
+};
+
+#endif
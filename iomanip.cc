@@ -24,33 +24,129 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 #include <iostream.h>
-#include <iomanip>
+#include <string.h>
+#include <algorithm>
+#include <queue>
 #include "qstate.h"
 
-ostream& ket(ostream& os, char* ket_val)
-{
-  return os << " |" << ket_val << '>';
-}
+/*
 
-omanip<char*> ket(char* ket_val)
-{
-  return omanip<char*> (ket, ket_val);
-} 
+States are printed in one pass through a fixed buffer of PRINT_BUF
+characters, which goes out with a single write whenever it fills up.
+Numbers and kets are formatted by hand, so printing costs about as
+much as reading the amplitudes: no manipulators, no temporary
+strings, no per-term stream calls.
 
-ostream& coeff(ostream& os, Complex c) 
-{
-  if( abs(imag(c)) > ROUND_ERR )
-      return os << '(' << setiosflags(ios::showpoint | ios::fixed)
-                << setprecision(6) << setw(8) << real(c) << ", "
-                << imag(c) << ')';
+*/
+
+//: Characters collected before they are written out.
+static const int PRINT_BUF = 1 << 16;
 
-  		return os << setiosflags(ios::showpoint | ios::fixed)
-            << setprecision(6) << setw(8) << real(c);
+//: Longest number: printf("%1.6f", -DBL_MAX) has 309 digits before
+// the point.
+static const int NUMBER_MAX = 1 + 309 + 1 + 6;
+
+//: Longest single term: " + (x, y) |ket>" with a 64-bit ket.
+static const int TERM_MAX = 3 + 4 + 2 * NUMBER_MAX + 2 + 64 + 1;
+
+class TermWriter
+//formats "amplitude |ket>" terms separated by " + "
+{
+private:
+	char _buf[PRINT_BUF];
+	int _len;
+	ostream *_os;							//either a stream...
+	FILE *_fh;								//...or a file
+	int _width;								//ket digits
+	bool _std;								//PrintSTD style
+	bool _first;
+
+	void _Flush()
+	{
+		if (_os) _os->write(_buf, _len);
+		else fwrite(_buf, 1, _len, _fh);
+		_len = 0;
+	}
+
+	void _Fixed(double x);
+
+public:
+	TermWriter(ostream &os, int width)
+		: _len(0), _os(&os), _fh(NULL), _width(width), _std(false), _first(true) {}
+
+	TermWriter(FILE *fh, int width)
+		: _len(0), _os(NULL), _fh(fh), _width(width), _std(true), _first(true) {}
+
+	void Term(QIndex i, const Complex &c);
+
+	void Put(char ch)
+	{
+		if (_len == PRINT_BUF) _Flush();
+		_buf[_len++] = ch;
+	}
+
+	//: End the line and write everything out.
+	void End()
+	{
+		Put('\n');
+		_Flush();
+		if (_os) _os->flush();
+		else fflush(_fh);
+	}
+};
+
+void TermWriter::_Fixed(double x)
+//same as printf("%1.6f", x)
+{
+	if (!(fabs(x) < 1e12)) {					//huge, inf or nan
+		int n = snprintf(_buf + _len, PRINT_BUF - _len, "%1.6f", x);
+		_len += (n < PRINT_BUF - _len) ? n : PRINT_BUF - _len - 1;
+		return;
+	}
+
+	if (signbit(x)) { _buf[_len++] = '-'; x = -x; }
+
+	unsigned long long v = (unsigned long long) floor(x * 1e6 + 0.5);
+	unsigned long long whole = v / 1000000;
+	unsigned int frac = v % 1000000;
+	char digits[24];
+	int n = 0;
+
+	do { digits[n++] = '0' + whole % 10; whole /= 10; } while (whole);
+	while (n) _buf[_len++] = digits[--n];
+
+	_buf[_len++] = '.';
+	for (int k = 5; k >= 0; k--, frac /= 10)
+		_buf[_len + k] = '0' + frac % 10;
+	_len += 6;
 }
 
-omanip<Complex> coeff(Complex c)
+void TermWriter::Term(QIndex i, const Complex &c)
 {
-  return omanip<Complex> (coeff, c);
+	if (_len > PRINT_BUF - TERM_MAX) _Flush();
+
+	if (!_first) {
+		memcpy(_buf + _len, " + ", 3);
+		_len += 3;
+	}
+	_first = false;
+
+	//PrintSTD shows any imaginary part, operator<< only visible ones
+	if (_std ? imag(c) != 0 : fabs(imag(c)) > ROUND_ERR) {
+		_buf[_len++] = '(';
+		_Fixed(real(c));
+		_buf[_len++] = ',';
+		if (!_std) _buf[_len++] = ' ';
+		_Fixed(imag(c));
+		_buf[_len++] = ')';
+	} else
+		_Fixed(real(c));
+
+	_buf[_len++] = ' ';
+	_buf[_len++] = '|';
+	for (int k = _width - 1; k >= 0; k--)
+		_buf[_len++] = '0' + ((i >> k) & 1);
+	_buf[_len++] = '>';
 }
 
 //added by Yan Pritzker 
@@ -65,31 +161,77 @@ bool ImagAndReal(const Complex &c) {
 
 ostream& operator<< (ostream& out, const QState &q)
 {	
-	int pad=count_bits(q._nStates-1);
-	
-	/* added by Yan Pritzker...to make sure + is printed even
-		if there is more than one 0 coefficient between states */
-	int nonzero=0; //number of nonzero probability states (for plus sign)
-	for( int i=0; i < q._nStates; i++ )
-		if(ImagOrReal(q._qArray[i])) nonzero++;
- 
- 
-  for(int i=0; i < q._nStates-1; i++) {
-    if(!ImagOrReal(q._qArray[i]))
-      continue; 
+	TermWriter w(out, q._nQubits);
+	QIndex i;
 
-    out << coeff(q._qArray[i]) << ket(dtob(i,pad));
+	for(i = q.NextNonZero(0); i < q._nStates; i = q.NextNonZero(i+1)) {
+		Complex c = q.Amp(i);
+		if(ImagOrReal(c))
+			w.Term(i, c);
+	}
 
-	if(--nonzero) cout << " + ";
-  }
+	w.End();
+	return out;
+}
 
-  if(!ImagOrReal(q._qArray[q._nStates-1])) {
-    out << endl; 
-    return out; 
-  }
+typedef std::pair<double, QIndex> Entry;		//(probability, outcome)
 
-  out << coeff(q._qArray[q._nStates-1]) 
-       << ket(dtob(q._nStates-1,pad)) << endl;
-	return out;
+static bool MoreProbable(const Entry &a, const Entry &b)
+//ties go to the lower outcome
+{
+	return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
 
+void QState::Print(ostream &out, QIndex top, double threshold) const
+{
+	std::priority_queue<Entry, std::vector<Entry>,
+							  bool (*)(const Entry&, const Entry&)> best(MoreProbable);
+	QIndex i;
+
+	if (top <= 0) {								//everything above threshold
+		TermWriter w(out, _nQubits);
+		for(i = NextNonZero(0); i < _nStates; i = NextNonZero(i+1)) {
+			Complex c = Amp(i);
+			if(ImagOrReal(c) && norm(c) >= threshold)
+				w.Term(i, c);
+		}
+		w.End();
+		return;
+	}
+
+	//keep the top most probable seen so far, least probable on top
+	for(i = NextNonZero(0); i < _nStates; i = NextNonZero(i+1)) {
+		Complex c = Amp(i);
+		Entry e(norm(c), i);
+		if(!ImagOrReal(c) || e.first < threshold) continue;
+		if((QIndex) best.size() < top)
+			best.push(e);
+		else if(MoreProbable(e, best.top())) {
+			best.pop();
+			best.push(e);
+		}
+	}
+
+	std::vector<Entry> list;
+	for( ; !best.empty(); best.pop()) list.push_back(best.top());
+
+	TermWriter w(out, _nQubits);
+	for(i = list.size() - 1; i >= 0; i--)			//most probable first
+		w.Term(list[i].second, Amp(list[i].second));
+	w.End();
+}
+
+void QState::PrintSTD() const
+{
+	TermWriter w(stdout, _nQubits);
+	QIndex i, last = -1;
+
+	for(i = NextNonZero(0); i < _nStates; i = NextNonZero(i+1)) {
+		w.Term(i, Amp(i));
+		last = i;
+	}
+ 
+	//a nonzero last outcome was followed by a blank line
+	if(last == _nStates-1) w.Put('\n');
+	w.End();
 }
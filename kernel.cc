@@ -0,0 +1,391 @@
+/* kernel.cc
+
+Vectorized 2x2 gate kernels.
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include "kernel.h"
+
+#if !defined(Q_NOSIMD) && defined(__GNUC__) && \
+	 (defined(__x86_64__) || defined(__i386__))
+#define Q_X86SIMD
+#include <immintrin.h>
+#endif
+
+typedef void (*PairsFn)(Complex *, Complex *, long, const Complex *);
+typedef void (*AdjacentFn)(Complex *, long, const Complex *);
+typedef void (*ScaleFn)(Complex *, long, const Complex &);
+typedef void (*MatrixFn)(Complex *, const QIndex *, int,
+								 const QReal *, const QReal *);
+
+//largest matrix ApplyMatrix() is used with (a 5 qubit block)
+static const int MAX_DIM = 32;
+
+/*** portable versions ***/
+
+static void ScalarPairs(Complex *lo, Complex *hi, long len, const Complex m[4])
+{
+	Complex a0, a1;
+	for (long i = 0; i < len; i++) {
+		a0 = lo[i];
+		a1 = hi[i];
+		lo[i] = m[0] * a0 + m[1] * a1;
+		hi[i] = m[2] * a0 + m[3] * a1;
+	}
+}
+
+static void ScalarAdjacent(Complex *a, long len, const Complex m[4])
+{
+	for (long i = 0; i < len; i++)
+		ScalarPairs(a + 2*i, a + 2*i + 1, 1, m);
+}
+
+static void ScalarScale(Complex *a, long len, const Complex &c)
+{
+	for (long i = 0; i < len; i++)
+		a[i] *= c;
+}
+
+static void ScalarMatrix(Complex *a, const QIndex *offs, int dim,
+								 const QReal *mr, const QReal *mi)
+{
+	QReal vr[MAX_DIM], vi[MAX_DIM], wr[MAX_DIM], wi[MAX_DIM];
+	int r, j;
+
+	for (r = 0; r < dim; r++) {
+		vr[r] = real(a[offs[r]]);
+		vi[r] = imag(a[offs[r]]);
+		wr[r] = wi[r] = 0;
+	}
+	//column by column, so the inner loop is element-wise
+	for (j = 0; j < dim; j++) {
+		const QReal *cr = mr + j * dim, *ci = mi + j * dim;
+		QReal xr = vr[j], xi = vi[j];
+		for (r = 0; r < dim; r++) {
+			wr[r] += cr[r] * xr - ci[r] * xi;
+			wi[r] += cr[r] * xi + ci[r] * xr;
+		}
+	}
+	for (r = 0; r < dim; r++)
+		a[offs[r]] = Complex(wr[r], wi[r]);
+}
+
+#ifdef Q_X86SIMD
+
+//The vector code is written once against the macros below, which map
+//to the double or the float (-DQ_SINGLE) intrinsics. Both keep
+//interleaved (re,im) pairs, so a complex product is a swap of re/im
+//followed by one fmaddsub.
+
+#ifdef Q_SINGLE
+typedef __m256 V256;
+typedef __m512 V512;
+#define L256	_mm256_loadu_ps
+#define S256	_mm256_storeu_ps
+#define B256	_mm256_set1_ps
+#define ADD256	_mm256_add_ps
+#define MUL256	_mm256_mul_ps
+#define FMAS256 _mm256_fmaddsub_ps
+#define SWAP256(a)	_mm256_permute_ps(a, 0xB1)
+#define Z256	_mm256_setzero_ps
+#define FMA256	_mm256_fmadd_ps
+#define FNMA256 _mm256_fnmadd_ps
+#define L512	_mm512_loadu_ps
+#define S512	_mm512_storeu_ps
+#define B512	_mm512_set1_ps
+#define ADD512	_mm512_add_ps
+#define MUL512	_mm512_mul_ps
+#define FMAS512 _mm512_fmaddsub_ps
+#define SWAP512(a)	_mm512_permute_ps(a, 0xB1)
+static const long W256 = 4, W512 = 8;	//complex numbers per register
+#else
+typedef __m256d V256;
+typedef __m512d V512;
+#define L256	_mm256_loadu_pd
+#define S256	_mm256_storeu_pd
+#define B256	_mm256_set1_pd
+#define ADD256	_mm256_add_pd
+#define MUL256	_mm256_mul_pd
+#define FMAS256 _mm256_fmaddsub_pd
+#define SWAP256(a)	_mm256_permute_pd(a, 0x5)
+#define Z256	_mm256_setzero_pd
+#define FMA256	_mm256_fmadd_pd
+#define FNMA256 _mm256_fnmadd_pd
+#define L512	_mm512_loadu_pd
+#define S512	_mm512_storeu_pd
+#define B512	_mm512_set1_pd
+#define ADD512	_mm512_add_pd
+#define MUL512	_mm512_mul_pd
+#define FMAS512 _mm512_fmaddsub_pd
+#define SWAP512(a)	_mm512_permute_pd(a, 0x55)
+static const long W256 = 2, W512 = 4;
+#endif
+
+/*** AVX2 + FMA ***/
+
+//complex product of a and b given as broadcast re/im parts
+__attribute__((target("avx2,fma"))) static inline
+V256 Mul256(V256 a, V256 bre, V256 bim)
+{
+	return FMAS256(a, bre, MUL256(SWAP256(a), bim));
+}
+
+__attribute__((target("avx2,fma")))
+static void Avx2Pairs(Complex *lo, Complex *hi, long len, const Complex m[4])
+{
+	V256 re[4], im[4];
+	for (int j = 0; j < 4; j++) {
+		re[j] = B256(real(m[j]));
+		im[j] = B256(imag(m[j]));
+	}
+
+	QReal *l = (QReal *) lo, *h = (QReal *) hi;
+	long i;
+	for (i = 0; i + W256 <= len; i += W256) {
+		V256 a0 = L256(l + 2*i);
+		V256 a1 = L256(h + 2*i);
+		S256(l + 2*i, ADD256(Mul256(a0, re[0], im[0]), Mul256(a1, re[1], im[1])));
+		S256(h + 2*i, ADD256(Mul256(a0, re[2], im[2]), Mul256(a1, re[3], im[3])));
+	}
+	ScalarPairs(lo + i, hi + i, len - i, m);
+}
+
+__attribute__((target("avx2,fma")))
+static void Avx2Adjacent(Complex *a, long len, const Complex m[4])
+{
+	//each register holds whole pairs (a0,a1); a0 is spread over the
+	//first-row slots and a1 over the second-row ones
+#ifdef Q_SINGLE
+	#define ROWS(x,y)	_mm256_setr_ps(real(x), real(x), real(y), real(y), \
+											real(x), real(x), real(y), real(y))
+	#define ROWSI(x,y)	_mm256_setr_ps(imag(x), imag(x), imag(y), imag(y), \
+											imag(x), imag(x), imag(y), imag(y))
+	#define FIRST(v)	_mm256_castpd_ps(_mm256_permute_pd(_mm256_castps_pd(v), 0x0))
+	#define SECOND(v)	_mm256_castpd_ps(_mm256_permute_pd(_mm256_castps_pd(v), 0xF))
+#else
+	#define ROWS(x,y)	_mm256_setr_pd(real(x), real(x), real(y), real(y))
+	#define ROWSI(x,y)	_mm256_setr_pd(imag(x), imag(x), imag(y), imag(y))
+	#define FIRST(v)	_mm256_permute2f128_pd(v, v, 0x00)
+	#define SECOND(v)	_mm256_permute2f128_pd(v, v, 0x11)
+#endif
+	V256 cre = ROWS(m[0], m[2]), cim = ROWSI(m[0], m[2]);
+	V256 dre = ROWS(m[1], m[3]), dim = ROWSI(m[1], m[3]);
+	const long per = W256 / 2;				//pairs per register
+
+	QReal *p = (QReal *) a;
+	long i;
+	for (i = 0; i + per <= len; i += per) {
+		V256 v = L256(p + 4*i);
+		S256(p + 4*i, ADD256(Mul256(FIRST(v), cre, cim),
+									Mul256(SECOND(v), dre, dim)));
+	}
+	ScalarAdjacent(a + 2*i, len - i, m);
+
+	#undef ROWS
+	#undef ROWSI
+	#undef FIRST
+	#undef SECOND
+}
+
+__attribute__((target("avx2,fma")))
+static void Avx2Scale(Complex *a, long len, const Complex &c)
+{
+	V256 re = B256(real(c));
+	V256 im = B256(imag(c));
+
+	QReal *p = (QReal *) a;
+	long i;
+	for (i = 0; i + W256 <= len; i += W256)
+		S256(p + 2*i, Mul256(L256(p + 2*i), re, im));
+	ScalarScale(a + i, len - i, c);
+}
+
+__attribute__((target("avx2,fma")))
+static void Avx2Matrix(Complex *a, const QIndex *offs, int dim,
+							  const QReal *mr, const QReal *mi)
+{
+	const int lanes = 2 * W256;				//reals per register
+	if (dim < lanes) {
+		ScalarMatrix(a, offs, dim, mr, mi);
+		return;
+	}
+
+	QReal vr[MAX_DIM], vi[MAX_DIM];
+	V256 wr[MAX_DIM / 4], wi[MAX_DIM / 4];
+	int r, j, n = dim / lanes;
+
+	for (r = 0; r < dim; r++) {
+		vr[r] = real(a[offs[r]]);
+		vi[r] = imag(a[offs[r]]);
+	}
+	for (r = 0; r < n; r++)
+		wr[r] = wi[r] = Z256();
+
+	for (j = 0; j < dim; j++) {
+		const QReal *cr = mr + j * dim, *ci = mi + j * dim;
+		V256 xr = B256(vr[j]), xi = B256(vi[j]);
+		for (r = 0; r < n; r++) {
+			V256 c0 = L256(cr + r * lanes), c1 = L256(ci + r * lanes);
+			wr[r] = FNMA256(c1, xi, FMA256(c0, xr, wr[r]));
+			wi[r] = FMA256(c1, xr, FMA256(c0, xi, wi[r]));
+		}
+	}
+
+	for (r = 0; r < n; r++) {
+		S256(vr + r * lanes, wr[r]);
+		S256(vi + r * lanes, wi[r]);
+	}
+	for (r = 0; r < dim; r++)
+		a[offs[r]] = Complex(vr[r], vi[r]);
+}
+
+/*** AVX-512 ***/
+
+__attribute__((target("avx512f"))) static inline
+V512 Mul512(V512 a, V512 bre, V512 bim)
+{
+	return FMAS512(a, bre, MUL512(SWAP512(a), bim));
+}
+
+__attribute__((target("avx512f")))
+static void Avx512Pairs(Complex *lo, Complex *hi, long len, const Complex m[4])
+{
+	V512 re[4], im[4];
+	for (int j = 0; j < 4; j++) {
+		re[j] = B512(real(m[j]));
+		im[j] = B512(imag(m[j]));
+	}
+
+	QReal *l = (QReal *) lo, *h = (QReal *) hi;
+	long i;
+	for (i = 0; i + W512 <= len; i += W512) {
+		V512 a0 = L512(l + 2*i);
+		V512 a1 = L512(h + 2*i);
+		S512(l + 2*i, ADD512(Mul512(a0, re[0], im[0]), Mul512(a1, re[1], im[1])));
+		S512(h + 2*i, ADD512(Mul512(a0, re[2], im[2]), Mul512(a1, re[3], im[3])));
+	}
+	ScalarPairs(lo + i, hi + i, len - i, m);
+}
+
+__attribute__((target("avx512f")))
+static void Avx512Scale(Complex *a, long len, const Complex &c)
+{
+	V512 re = B512(real(c));
+	V512 im = B512(imag(c));
+
+	QReal *p = (QReal *) a;
+	long i;
+	for (i = 0; i + W512 <= len; i += W512)
+		S512(p + 2*i, Mul512(L512(p + 2*i), re, im));
+	ScalarScale(a + i, len - i, c);
+}
+
+#endif
+
+/*** runtime selection ***/
+
+static PairsFn		_pairs;
+static AdjacentFn	_adjacent;
+static ScaleFn		_scale;
+static MatrixFn	_matrix;
+static const char	*_name;
+
+static void SelectKernels()
+{
+	_pairs = ScalarPairs;
+	_adjacent = ScalarAdjacent;
+	_scale = ScalarScale;
+	_matrix = ScalarMatrix;
+	_name = "scalar";
+
+#ifdef Q_X86SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		_pairs = Avx2Pairs;
+		_adjacent = Avx2Adjacent;
+		_scale = Avx2Scale;
+		_matrix = Avx2Matrix;
+		_name = "avx2";
+	}
+	if (__builtin_cpu_supports("avx512f")) {
+		_pairs = Avx512Pairs;	//neighbouring pairs and matrices stay on AVX2
+		_scale = Avx512Scale;
+		_name = "avx512";
+	}
+#endif
+}
+
+//selected during static initialization, before main() starts any
+//worker threads; the checks below only matter for gates applied from
+//other static constructors
+static struct KernelInit { KernelInit() { SelectKernels(); } } _kernel_init;
+
+void ApplyPairs(Complex *lo, Complex *hi, long len, const Complex m[4])
+{
+	if (!_pairs) SelectKernels();
+	_pairs(lo, hi, len, m);
+}
+
+void ApplyAdjacentPairs(Complex *a, long len, const Complex m[4])
+{
+	if (!_adjacent) SelectKernels();
+	_adjacent(a, len, m);
+}
+
+void ScaleRun(Complex *a, long len, const Complex &c)
+{
+	if (!_scale) SelectKernels();
+	_scale(a, len, c);
+}
+
+void ApplyMatrix(Complex *a, const QIndex *offs, int dim,
+					  const QReal *mr, const QReal *mi)
+{
+	if (!_matrix) SelectKernels();
+	_matrix(a, offs, dim, mr, mi);
+}
+
+void SwapRuns(Complex *lo, Complex *hi, long len, const Complex m[4])
+{
+	Complex t;
+	long i;
+
+	//a swap is pure data movement, the compiler vectorizes it well enough
+	if (m[1] == Complex(1) && m[2] == Complex(1))
+		for (i = 0; i < len; i++) {
+			t = lo[i];
+			lo[i] = hi[i];
+			hi[i] = t;
+		}
+	else
+		for (i = 0; i < len; i++) {
+			t = lo[i];
+			lo[i] = m[1] * hi[i];
+			hi[i] = m[2] * t;
+		}
+}
+
+const char *KernelName()
+{
+	if (!_name) SelectKernels();
+	return _name;
+}
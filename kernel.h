@@ -0,0 +1,75 @@
+/* kernel.h
+
+Vectorized 2x2 gate kernels.
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+//! lib="Gate Kernels"
+
+/*
+
+Every one-bit gate, controlled or not, ends up multiplying pairs of
+amplitudes (a0,a1) by its 2x2 matrix:
+
+	a0' = m[0]*a0 + m[1]*a1
+	a1' = m[2]*a0 + m[3]*a1
+
+The functions below do this for a whole run of pairs at once. On x86
+the best version for the running CPU (AVX-512, AVX2+FMA or plain C++)
+is picked the first time a kernel is called. Compile with -DQ_NOSIMD
+to always use the portable version.
+
+Diagonal and anti-diagonal gates (see GateClass in qop.h) have their
+own, cheaper entry points: ScaleRun() and SwapRuns(). Gates fused into
+a block of k qubits (see circuit.h) use ApplyMatrix() on each group of
+2^k amplitudes instead.
+
+*/
+
+#ifndef _KERNEL_H_
+#define _KERNEL_H_
+
+#include "complex.h"
+#include "utility.h"
+
+//: Apply m to len pairs (lo[i], hi[i]); lo and hi are separate runs.
+void ApplyPairs(Complex *lo, Complex *hi, long len, const Complex m[4]);
+
+//: Apply m to len neighbouring pairs (a[2i], a[2i+1]). (gates on bit 0)
+void ApplyAdjacentPairs(Complex *a, long len, const Complex m[4]);
+
+//: Multiply len amplitudes by c. (one half of a diagonal gate)
+void ScaleRun(Complex *a, long len, const Complex &c);
+
+//: Exchange runs lo and hi, scaled by m[1] and m[2]. (anti-diagonal gates)
+// With m[1] == m[2] == 1 this is a plain swap without multiplications.
+void SwapRuns(Complex *lo, Complex *hi, long len, const Complex m[4]);
+
+//: Multiply the dim amplitudes a[offs[i]] by a dense dim x dim matrix.
+// mr and mi are its real and imaginary parts, stored column by column.
+void ApplyMatrix(Complex *a, const QIndex *offs, int dim,
+					  const QReal *mr, const QReal *mi);
+
+//: Name of the kernel set in use ("avx512", "avx2" or "scalar").
+const char *KernelName();
+
+#endif
@@ -23,32 +23,34 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 #include <string.h>
+#include <stdlib.h>
+#include <new>
+#include <unistd.h>
+#include <sys/time.h>
 #include <iostream.h>
 #include "quantum"
 #include <vector>
 
-int Count(QState &q)
+QIndex Count(QState &q)
 {
-   static int count;
-   int temp=0;
-   for(int i=0; i<q.Outcomes(); ++i)
-      if(abs(real(q[i])) > ROUND_ERR ||
-         abs(imag(q[i])) > ROUND_ERR)
-         temp++;
+   static QIndex count;
+   QIndex temp=q.NonZero(ROUND_ERR);	//doesn't densify a sparse state
 
    count = (temp > count) ? temp : count;
 	return count;
 }
 
-int main() {
+int Interactive() {
 
 	//some operators we will be using     
 	ModExp MX;
+	PeriodComb comb;
 	FFT	fft;
 
-	int x;
-	int M;
+	QIndex x;
+	QIndex M;
 	char diag;	
+	char shortcut = 'n';
 	
 	cout  << "OpenQubit version 0.2.0, Copyright (C) 1999 OpenQubit.org\n"
 			<< "The OpenQubit library comes with ABSOLUTELY NO WARRANTY; "
@@ -58,14 +60,14 @@ int main() {
 
 	printf("Shor's algorithm for factoring numbers\n");
 	printf("Would you like array usage diagnostics? (y/n) ");
-	scanf("%s",&diag);
+	scanf(" %c",&diag);
 	printf("Enter number to factorize\n");
-	scanf("%d",&M);
+	scanf("%lld",&M);
 	
 	if (M % 2 !=1)
 	{
 	  printf("The number is even. Factors found\n");
-	  printf("%d = 2 * %d\n",M,M/2);
+	  printf("%lld = 2 * %lld\n",M,M/2);
 	  exit(0);
 	} 
 
@@ -83,54 +85,68 @@ int main() {
 	}
 
 	//usually this is taken randomly
-	printf("Enter a number from 1..%d \n",M-1);
-	scanf("%d",&x);
+	printf("Enter a number from 1..%lld \n",M-1);
+	scanf("%lld",&x);
       
-	int factor = GCD(M,x);
+	QIndex factor = GCD(M,x);
 
 	if (factor!=1 && factor!=M) 
 	{
-		printf("Factor found since GCD(%d,%d)=%d\n",M,x,factor);
-		printf("%d = %d * %d\n",M,factor,M/factor);
+		printf("Factor found since GCD(%lld,%lld)=%lld\n",M,x,factor);
+		printf("%lld = %lld * %lld\n",M,factor,M/factor);
 		exit(0);
 	}
 
+	//asked last, so input written for the full simulation still works
+	printf("Skip the second register and build the measured comb? (y/n) ");
+	scanf(" %c",&shortcut);
+
 	// first part size
 	int first=count_bits(M*M); //continued fraction expansion 
 										//needs enough bits to represent 
 	                           //M^2
-	int firstsize=1<<first;
+	QIndex firstsize=(QIndex) 1<<first;
 
 	// total register size
-	int bits=first + count_bits(M);//values after modular exponentiation are < M
-	int size= 1<<bits;
+	int bits=first;
+	if (shortcut != 'y' && shortcut != 'Y')
+		bits += count_bits(M);		//values after modular exponentiation are < M
+	QIndex size= (QIndex) 1<<bits;
 
 	QState *qureg;
-	std::vector<Complex> StateCoefs(size);
-	// /equal superposition of all the states in register 1
-	// and |0..0> in register 2
-	for (int k=0; k<firstsize;k++)
-		StateCoefs[k]=1/sqrt(firstsize); 
+	Hadamard H;
 
-	qureg = new QState(bits,StateCoefs);
+	if (bits > first) {
+		// /equal superposition of all the states in register 1
+		// and |0..0> in register 2. Built with gates rather than from a
+		// full coefficient array so that a large register can stay sparse.
+		qureg = new QState(bits);
+		for (int k=0; k<first; k++)
+			H(*qureg,k);
 	 
-	//benchmarking tool
- 	Count(*qureg);
+		//benchmarking tool
+ 		Count(*qureg);
 
-	printf("Preparing equal superposition in the first register\n");
-	//	qureg->Print();
+		printf("Preparing equal superposition in the first register\n");
+		//	qureg->Print();
  
-	// Act with modular expenentiation function
-	MX(*qureg,x,M,first);
-	Count(*qureg);
-	printf("Modular exponentiation\n");
-	//        qureg->Print();
+		// Act with modular expenentiation function
+		MX(*qureg,x,M,first);
+		Count(*qureg);
+		printf("Modular exponentiation\n");
+		//        qureg->Print();
 	
-	//Uncomment if you want to try measuring the second register
-	//It'd probably be working too
-
-	for (int k=first;k<bits;k++)
-		Measure(*qureg,k);
+		MeasureSet(*qureg, (((QIndex) 1 << (bits-first)) - 1) << first);
+	} else {
+		// Measuring the second register picks x^a mod M for a uniform a
+		// and leaves the first register periodic; PeriodComb builds
+		// that directly, without the second register.
+		PhiloxRandGenerator rng;
+		qureg = new QState(first);
+		QIndex y = comb(*qureg, x, M, (QIndex) (rng.Uniform() * firstsize));
+		Count(*qureg);
+		printf("Second register sampled classically: %lld\n", y);
+	}
               
 	//	qureg->Print();	
 
@@ -140,7 +156,7 @@ int main() {
 	Count(*qureg);
 	//        qureg->Print();
 
-	int result = 0;
+	QIndex result = 0;
 
 	printf("Measurement\n");
 	result=Measure(*qureg);
@@ -155,13 +171,13 @@ int main() {
 	// Procedure ReverseBits doesn't work
 	result=Reverse(result,first);
 
-	printf("The result is %d\n",result);
-	printf("Fourier domain is %d\n",firstsize);
+	printf("The result is %lld\n",result);
+	printf("Fourier domain is %lld\n",firstsize);
 	// Use continued fraction expansion to extract the period
 
-	int period=PeriodExtract(result,M,firstsize);
+	QIndex period=PeriodExtract(result,M,firstsize);
 	printf("Extracting the period using continued fraction expansion\n");
-	printf("Period guess is: %d\n",period);
+	printf("Period guess is: %lld\n",period);
 
 	if (period !=0 && modexp(x,period,M) == 1) //we check if it is true period
 		printf("Period guess is probably correct\n");
@@ -178,14 +194,15 @@ int main() {
 		if (factor!=1 && factor!=M) 
 		{
 			printf("Factors found!\n");
-			printf("%d = %d * %d\n",M,factor,M/factor);
+			printf("%lld = %lld * %lld\n",M,factor,M/factor);
 		}
 		else
 			if (factor==1)
 				printf("Procedure failed due to bad period guess\n");
 			else
 	    	{
-				printf("Procedure failed since %d^%d mod %d == -1\n",x,period/2,M);
+				printf("Procedure failed since %lld^%lld mod %lld == -1\n",
+						 x,period/2,M);
 				printf("Try again with another number\n");
 				exit(0);
 			}
@@ -193,19 +210,265 @@ int main() {
 	else
 		printf("Procedure failed; period is odd\n");
 	
-	int nonzerocoefs = Count(*qureg);
-	int zerocoefs = size-nonzerocoefs;
+	QIndex nonzerocoefs = Count(*qureg);
+	QIndex zerocoefs = size-nonzerocoefs;
 	if (diag == 'y' || diag == 'Y') {
-		printf("\nDiagnostics for factoring the number %d...\n", M);
+		printf("\nDiagnostics for factoring the number %lld...\n", M);
 		printf("Used %d qubits to factor this number.\n", bits);
-		printf("Total number of elements in coef array: \t %d\n", 1 << bits);
-		printf("Maximum non-zero coefs in array: \t\t %d\n", nonzerocoefs);
-		printf("Total size (in bytes) of the array: \t\t %d\n", 
-					sizeof(Complex) * size);
-		printf("Bytes of array used by non-zero coefs: \t %d\n",
-					nonzerocoefs*sizeof(Complex));
-		printf("Percent of array wasted by zero coefs: \t %d bytes (%f%%)\n",
-				zerocoefs*sizeof(Complex), zerocoefs*100/(double)size);				
+		printf("Total number of elements in coef array: \t %lld\n", size);
+		printf("Maximum non-zero coefs in array: \t\t %lld\n", nonzerocoefs);
+		printf("Total size (in bytes) of the array: \t\t %lld\n", 
+					(QIndex) sizeof(Complex) * size);
+		printf("Bytes of array used by non-zero coefs: \t %lld\n",
+					nonzerocoefs*(QIndex) sizeof(Complex));
+		printf("Percent of array wasted by zero coefs: \t %lld bytes (%f%%)\n",
+				zerocoefs*(QIndex) sizeof(Complex), zerocoefs*100/(double)size);				
 	}
 	return 0;
 }
+
+/*
+
+Batch mode: shor [options] M... factors every M on the command line
+(and in -f file) without asking anything. Each trial draws random
+bases until one is coprime to M (a base sharing a factor with M would
+factor it without the quantum part, so the report would not show that
+the period finding works), builds the comb of the first register (see
+PeriodComb in qop.h), transforms it and measures it -s times; the
+samples come from the one transformed state, which is what the
+algorithm would give after the same second-register outcome. Trials
+run -j at a time, each on one core (a single trial spreads its gates
+over all of them); a factor only counts once it divides M. The first verified factor, in trial order, ends
+the search, so a fixed -r seed gives the same report whatever -j is.
+
+*/
+
+//: Outcome of one trial.
+struct Trial {
+	QIndex x;								//: base
+	QIndex measured;						//: last FFT outcome, reversed
+	QIndex period;							//: last period guess
+	QIndex factor;							//: nontrivial factor, or 0
+	long shots;								//: measurements made
+	double seconds;						//: wall time
+	bool nomem;								//: a register could not be allocated
+};
+
+static double Now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static void Period(QIndex M, PhiloxRandGenerator &g, uint64_t t,
+						 long shots, Trial &r)
+{
+	int first = count_bits(M*M);
+	QIndex firstsize = (QIndex) 1 << first;
+	QIndex f;
+
+	QState q(first);
+	PeriodComb comb;
+	FFT fft;
+	comb(q, r.x, M, (QIndex) (g.Uniform() * firstsize));
+	fft(q, first);
+
+	QSampler *s = NULL;
+	if (shots > 1) s = new QSampler(q, (uint64_t) (g.Uniform() * 9007199254740992.0) + 1);
+	else q.Seed((unsigned) (g.Uniform() * 4294967295.0) + 1, (unsigned) t);
+
+	while (r.shots < shots && !r.factor) {
+		QIndex v = s ? s->Sample() : Measure(q);
+		r.shots++;
+		r.measured = Reverse(v % firstsize, first);
+		r.period = PeriodExtract(r.measured, M, firstsize);
+
+		if (r.period != 0 && r.period % 2 == 0 && modexp(r.x, r.period, M) == 1) {
+			f = GCD(modexp(r.x, r.period/2, M) + 1, M);
+			if (f != 1 && f != M && M % f == 0) r.factor = f;
+		}
+	}
+
+	delete s;
+}
+
+static void RunTrial(QIndex M, const PhiloxRandGenerator &rng, uint64_t t,
+							long shots, Trial &r)
+//runs inside the parallel loop of Factor(), so nothing may escape it
+{
+	PhiloxRandGenerator g = rng.Split(t);
+	double start = Now();
+
+	r.measured = r.period = r.factor = 0;
+	r.shots = 0;
+	r.nomem = false;
+
+	do r.x = 2 + (QIndex) (g.Uniform() * (M - 3));		//2..M-2
+	while (GCD(M, r.x) != 1);
+
+	try {
+		Period(M, g, t, shots, r);
+	} catch (std::bad_alloc &) {
+		r.nomem = true;
+	}
+	r.seconds = Now() - start;
+}
+
+static double Bytes(int first, long shots)
+//memory one trial needs: the register, and the sampler's tables
+{
+	double n = (double) ((QIndex) 1 << first);
+	return n * sizeof(Complex) + (shots > 1 ? n * (2 * sizeof(QIndex) + sizeof(double)) : 0);
+}
+
+static bool Factor(QIndex M, long trials, int jobs, long shots, uint64_t seed,
+						 double memory)
+{
+	printf("%lld:\n", M);
+	if (M < 4) {
+		printf("  nothing to factor\n");
+		return false;
+	}
+	if (M % 2 == 0) {
+		printf("  %lld = 2 * %lld (even)\n", M, M/2);
+		return true;
+	}
+	if (IsPrime(M)) {
+		printf("  %lld is prime\n", M);
+		return false;
+	}
+	if (IsPrimePower(M)) {
+		printf("  %lld is a prime power\n", M);
+		return false;
+	}
+
+	//M*M is only formed once it is known to fit in a QIndex
+	if (count_bits(M) > 31) {
+		printf("  too large (needs a %d qubit register)\n", 2 * count_bits(M));
+		return false;
+	}
+	int first = count_bits(M*M);
+	double need = Bytes(first, shots);
+	if (need > memory) {
+		printf("  too large (needs a %d qubit register, %.0f MB)\n",
+				 first, need / (1 << 20));
+		return false;
+	}
+
+	//several registers at once only while they are small
+	if (jobs <= 0)
+		jobs = ((QIndex) 1 << first) * (QIndex) sizeof(Complex) <= (64 << 20)
+				 ? GetThreads() : 1;
+	if (jobs * need > memory) {
+		jobs = (int) (memory / need);
+		printf("  %d trial%s at a time to fit in memory\n", jobs, jobs > 1 ? "s" : "");
+	}
+
+	PhiloxRandGenerator rng(seed);
+	double start = Now();
+
+	for (long t = 0; t < trials; t += jobs) {
+		int n = (trials - t < jobs) ? trials - t : jobs, i;
+		std::vector<Trial> r(n);
+
+		#pragma omp parallel for schedule(dynamic,1) num_threads(n) if(n > 1)
+		for (i = 0; i < n; i++)
+			RunTrial(M, rng, t + i, shots, r[i]);
+
+		for (i = 0; i < n; i++) {
+			printf("  trial %ld: x=%lld", t + i + 1, r[i].x);
+			if (r[i].nomem) {
+				printf(" out of memory\n");
+				return false;
+			}
+			if (r[i].shots)
+				printf(" measured=%lld period=%lld shots=%ld",
+						 r[i].measured, r[i].period, r[i].shots);
+			printf(" %s %.3fs\n", r[i].factor ? "ok" : "failed", r[i].seconds);
+
+			if (r[i].factor) {
+				printf("  %lld = %lld * %lld (%d qubits, %.3fs)\n", M, r[i].factor,
+						 M / r[i].factor, first, Now() - start);
+				return true;
+			}
+		}
+	}
+
+	printf("  no factor in %ld trials\n", trials);
+	return false;
+}
+
+static void Usage()
+{
+	fprintf(stderr,
+		"usage: shor                        (interactive)\n"
+		"       shor [options] M... [-f file]\n"
+		"  -f file    read more numbers from file\n"
+		"  -n trials  give up after this many bases (default 20)\n"
+		"  -j jobs    trials run at the same time (default: all cores\n"
+		"             if the register is at most 64MB, else 1)\n"
+		"  -s shots   measurements of each transformed register (default 1)\n"
+		"  -r seed    random seed (default: from the clock)\n"
+		"  -m MB      memory for the registers (default: physical memory)\n"
+		"  -p         print the time spent in each gate (needs -DQ_PROFILE)\n"
+		"  -t file    write a Chrome trace of the gates to file (ditto)\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<QIndex> numbers;
+	long trials = 20, shots = 1;
+	int jobs = 0, c;
+	uint64_t seed = 0;
+	bool profile = false;
+	const char *trace = NULL;
+	double memory = (double) sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+
+	if (argc == 1) return Interactive();
+
+	while ((c = getopt(argc, argv, "f:n:j:s:r:m:pt:")) != -1)
+		switch (c) {
+		case 'f': {
+			FILE *FH = fopen(optarg, "r");
+			long long m;
+			if (FH == NULL) {
+				cerr << "ERROR: could not open file " << optarg << endl;
+				return 2;
+			}
+			while (fscanf(FH, "%lld", &m) == 1) numbers.push_back(m);
+			fclose(FH);
+			break;
+		}
+		case 'n': trials = atol(optarg); break;
+		case 'j': jobs = atoi(optarg); break;
+		case 's': shots = atol(optarg); break;
+		case 'r': seed = strtoull(optarg, NULL, 0); break;
+		case 'm': memory = atof(optarg) * (1 << 20); break;
+		case 'p': profile = true; break;
+		case 't': trace = optarg; break;
+		default: Usage();
+		}
+
+	for ( ; optind < argc; optind++) {
+		char *end;
+		long long m = strtoll(argv[optind], &end, 0);
+		if (*end) Usage();
+		numbers.push_back(m);
+	}
+	if (numbers.empty() || trials < 1 || shots < 1 || memory <= 0) Usage();
+
+	if (profile || trace) ProfileStart(trace != NULL);
+
+	int failed = 0;
+	for (size_t i = 0; i < numbers.size(); i++)
+		if (!Factor(numbers[i], trials, jobs, shots, seed, memory)) failed++;
+
+	ProfileStop();
+	if (profile) ProfileReport();
+	if (trace && !ProfileTrace(trace))
+		cerr << "ERROR: could not write " << trace << endl;
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,58 @@
+/* parallel.h
+
+Thread control for gate kernels and state reductions.
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+//! lib="Parallel Execution"
+
+/*
+
+Gate kernels and reductions over the amplitude array are split into
+chunks of PAR_CHUNK amplitudes which are handed to worker threads
+(OpenMP, enabled with -fopenmp in the Makefile). Without OpenMP the
+pragmas are ignored and everything runs on one core as before.
+
+Reductions (norm, measurement probabilities) first sum each chunk and
+then add the partial sums in chunk order, so the result is bit for bit
+the same no matter how many threads did the work.
+
+*/
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//: Number of amplitudes (or amplitude pairs) in one unit of work.
+// States smaller than this are always handled by a single thread.
+static const int PAR_CHUNK = 1 << 14;
+
+//: Set the number of worker threads. (0 = use all available cores)
+void SetThreads(int n);
+
+//: Number of worker threads kernels will use.
+int GetThreads();
+
+#endif
@@ -0,0 +1,199 @@
+/* profile.cc
+
+Per-gate timing and memory traffic
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include "profile.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef Q_PROFILE
+
+bool profileOn = false;
+
+//at most this many calls are kept for the timeline (about 40MB)
+static const size_t PROFILE_EVENTS = 1 << 20;
+
+struct ProfileSite
+{
+	const char *name;
+	long calls;
+	double seconds, bytes;
+};
+
+struct ProfileEvent
+{
+	int site, thread;
+	double start, seconds, bytes;
+};
+
+static std::vector<ProfileSite> sites;
+static std::vector<ProfileEvent> events;
+static bool trace = false;
+static double epoch = -1;			//time 0 of the timeline
+static long dropped = 0;			//calls not kept for the timeline
+
+static int Site(const char *name)
+//the names are string literals, so the pointer usually matches; the
+//same name written in two files is still one row
+{
+	int i;
+	for (i = 0; i < (int) sites.size(); i++)
+		if (sites[i].name == name) return i;
+	for (i = 0; i < (int) sites.size(); i++)
+		if (strcmp(sites[i].name, name) == 0) return i;
+
+	ProfileSite s = { name, 0, 0.0, 0.0 };
+	sites.push_back(s);
+	return i;
+}
+
+void ProfileRecord(const char *name, double start, double end, double bytes)
+{
+	#pragma omp critical (profile)
+	{
+		int i = Site(name);
+		sites[i].calls++;
+		sites[i].seconds += end - start;
+		sites[i].bytes += bytes;
+
+		if (trace) {
+			if (events.size() < PROFILE_EVENTS) {
+				ProfileEvent e = { i, 0, start, end - start, bytes };
+#ifdef _OPENMP
+				e.thread = omp_get_thread_num();
+#endif
+				events.push_back(e);
+			} else
+				dropped++;
+		}
+	}
+}
+
+void ProfileStart(bool timeline)
+{
+	#pragma omp critical (profile)
+	{
+		if (epoch < 0) epoch = ProfileClock();
+		trace = timeline;
+		profileOn = true;
+	}
+}
+
+void ProfileStop()
+{
+	profileOn = false;
+}
+
+void ProfileReset()
+{
+	#pragma omp critical (profile)
+	{
+		sites.clear();
+		events.clear();
+		dropped = 0;
+		epoch = profileOn ? ProfileClock() : -1;
+	}
+}
+
+static bool Slower(const ProfileSite &a, const ProfileSite &b)
+{
+	return a.seconds > b.seconds;
+}
+
+void ProfileReport(FILE *out)
+{
+	std::vector<ProfileSite> s;
+	double total = 0.0;
+	size_t i;
+
+	#pragma omp critical (profile)
+	s = sites;
+
+	std::sort(s.begin(), s.end(), Slower);
+	for (i = 0; i < s.size(); i++) total += s[i].seconds;
+
+	fprintf(out, "%-14s %10s %10s %10s %10s %8s %6s\n",
+			  "gate", "calls", "total s", "mean ms", "GB", "GB/s", "time%");
+	for (i = 0; i < s.size(); i++)
+		fprintf(out, "%-14s %10ld %10.3f %10.3f %10.3f %8.2f %6.1f\n",
+				  s[i].name, s[i].calls, s[i].seconds,
+				  1e3 * s[i].seconds / s[i].calls, 1e-9 * s[i].bytes,
+				  s[i].seconds > 0 ? 1e-9 * s[i].bytes / s[i].seconds : 0.0,
+				  total > 0 ? 100 * s[i].seconds / total : 0.0);
+	if (s.empty())
+		fprintf(out, "(nothing recorded)\n");
+}
+
+bool ProfileTrace(const char *filename)
+//one complete ("X") event per call, times in microseconds from
+//ProfileStart(); the OpenMP thread that made the call is its tid
+{
+	FILE *f = fopen(filename, "w");
+	if (!f) return false;
+
+	#pragma omp critical (profile)
+	{
+		int pid = getpid();
+
+		fprintf(f, "{\"traceEvents\":[\n");
+		for (size_t i = 0; i < events.size(); i++) {
+			const ProfileEvent &e = events[i];
+			fprintf(f, "{\"name\":\"%s\",\"cat\":\"gate\",\"ph\":\"X\","
+					  "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+					  "\"args\":{\"bytes\":%.0f,\"GB/s\":%.3f}}%s\n",
+					  sites[e.site].name, 1e6 * (e.start - epoch), 1e6 * e.seconds,
+					  pid, e.thread, e.bytes,
+					  e.seconds > 0 ? 1e-9 * e.bytes / e.seconds : 0.0,
+					  i + 1 < events.size() ? "," : "");
+		}
+		fprintf(f, "],\n\"displayTimeUnit\":\"ms\",\n"
+				  "\"otherData\":{\"dropped\":%ld}}\n", dropped);
+	}
+
+	return fclose(f) == 0;
+}
+
+#else
+
+void ProfileStart(bool) {}
+void ProfileStop() {}
+void ProfileReset() {}
+
+void ProfileReport(FILE *out)
+{
+	fprintf(out, "(profiling not compiled in, build with -DQ_PROFILE)\n");
+}
+
+bool ProfileTrace(const char *)
+{
+	return false;
+}
+
+#endif
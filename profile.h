@@ -0,0 +1,120 @@
+/* profile.h
+
+Per-gate timing and memory traffic
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+//! lib="Quantum State [OpenQubit Core]"
+
+/*
+
+Built with -DQ_PROFILE (see the Makefile), every gate, FFT, ModExp and
+measurement records how often it ran, for how long and how many bytes
+of amplitudes it read and wrote. Nothing is recorded until asked for:
+
+	ProfileStart(true);			//true: also keep a timeline
+	...simulation...
+	ProfileStop();
+	ProfileReport();				//table on stdout
+	ProfileTrace("shor.json");	//open in chrome://tracing or Perfetto
+
+The report gives, per gate, the calls, the total and mean time and the
+achieved bandwidth. A gate whose GB/s is close to what the machine can
+stream is bandwidth-bound, and only touching less memory will make it
+faster. The byte counts are what the kernels have to move (one read and
+one write of every amplitude they visit), not measured traffic.
+
+When profiling is stopped a gate pays one test of a global flag. Without
+-DQ_PROFILE the PROFILE() lines compile to nothing, and the functions
+below only report that there is no data.
+
+*/
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdio.h>
+#include <time.h>
+
+//: Start recording; with trace every call is also kept for ProfileTrace().
+void ProfileStart(bool trace = false);
+
+//: Stop recording. What was recorded is kept.
+void ProfileStop();
+
+//: Forget everything recorded so far.
+void ProfileReset();
+
+//: Print a table of the recorded gates, the most expensive first.
+void ProfileReport(FILE *out = stdout);
+
+//: Write the recorded calls as Chrome trace JSON. false on failure.
+bool ProfileTrace(const char *filename);
+
+#ifdef Q_PROFILE
+
+extern bool profileOn;
+
+//: Seconds on a monotonic clock.
+inline double ProfileClock()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+void ProfileRecord(const char *name, double start, double end, double bytes);
+
+class ProfileScope
+//: Times the enclosing block as one call of name. (see PROFILE())
+{
+public:
+	ProfileScope(const char *name, double bytes)
+		: _name(name), _bytes(bytes), _start(profileOn ? ProfileClock() : -1) {}
+
+	~ProfileScope()
+		{ if (_start >= 0) ProfileRecord(_name, _start, ProfileClock(), _bytes); }
+
+	void AddBytes(double bytes) { _bytes += bytes; }
+
+private:
+	const char *_name;
+	double _bytes, _start;
+};
+
+//: Time the rest of the block as a call of name moving bytes bytes.
+// bytes is only evaluated while profiling is on.
+#define PROFILE(name, bytes) \
+	ProfileScope _profile(name, profileOn ? (double) (bytes) : 0.0)
+
+//: Count more bytes for the PROFILE() of the enclosing block, for
+// operations whose traffic is only known as they go.
+#define PROFILE_BYTES(bytes) \
+	do { if (profileOn) _profile.AddBytes(bytes); } while (0)
+
+#else
+
+#define PROFILE(name, bytes)
+#define PROFILE_BYTES(bytes)
+
+#endif
+
+#endif
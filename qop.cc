@@ -1,63 +1,402 @@
+#include <algorithm>
 #include "qop.h"
+#include "kernel.h"
+#include "profile.h"
 
-void SingleBit::operator() (QState &q, int bit=0)
+static inline void ApplyRun(GateClass c, Complex *lo, Complex *hi, long len,
+									 const Complex m[4])
+//apply a gate to a run of pairs using the cheapest kernel for its shape
+{
+	switch (c) {
+	case GATE_DIAGONAL:				//phases only; skip halves left alone
+		if (m[0] != Complex(1)) ScaleRun(lo, len, m[0]);
+		if (m[3] != Complex(1)) ScaleRun(hi, len, m[3]);
+		break;
+	case GATE_ANTIDIAGONAL:
+		SwapRuns(lo, hi, len, m);
+		break;
+	default:
+		ApplyPairs(lo, hi, len, m);
+	}
+}
+
+static inline void ApplyPair(GateClass c, Complex &lo, Complex &hi,
+									  const Complex m[4])
+//same as above for a single pair
+{
+	Complex a0 = lo, a1 = hi;
+
+	switch (c) {
+	case GATE_DIAGONAL:
+		lo = m[0] * a0;
+		hi = m[3] * a1;
+		break;
+	case GATE_ANTIDIAGONAL:
+		lo = m[1] * a1;
+		hi = m[2] * a0;
+		break;
+	default:
+		lo = m[0] * a0 + m[1] * a1;
+		hi = m[2] * a0 + m[3] * a1;
+	}
+}
+
+#ifdef Q_PROFILE
+static double Traffic(QState &q, QIndex part = 1)
+//bytes read and written by a sweep over 1/part of the amplitudes (for
+//the profile)
 {
-	std::vector<Complex> _qArrayTmp(q.Outcomes());  //results will first go here
-	int maski  = 1 << bit;  // set bit mask
-	int k;
-  
-	for (k = 0; k < q.Outcomes(); k++)
-		if (k & maski)  		// bit set so we use second row of the matrix
-			_qArrayTmp[k] = _a10 * q[k ^ maski] + _a11 * q[k];
+	QIndex n = q.IsSparse() ? q.Sparse().size() : q.Outcomes() / part;
+	return 2.0 * n * sizeof(Complex);
+}
+#endif
+
+static void SparseApply(QState &q, QIndex mask, QIndex maski, GateClass c,
+								const Complex m[4])
+//apply a (controlled) one-bit gate to a sparse state. Each pair is
+//handled when its first stored member is reached; a missing member is
+//zero and only gets stored if the gate makes it nonzero.
+{
+	QState::SparseArray &s = q.Sparse();
+	QState::SparseArray::iterator it, pt;
+	Complex a0, a1;
+
+	for (it = s.begin(); it != s.end(); ++it) {
+		QIndex k = it->first;
+		if ((k & mask) != mask) continue;
+
+		if (c == GATE_DIAGONAL) {		//no new amplitudes can appear
+			it->second *= (k & maski) ? m[3] : m[0];
+			continue;
+		}
+
+		if (k & maski) {
+			//partner is behind us; if it is stored the pair is done
+			if (s.find(k ^ maski) != s.end()) continue;
+			a0 = 0;
+			a1 = it->second;
+			ApplyPair(c, a0, a1, m);
+			it->second = a1;
+			if (norm(a0) > SPARSE_DROP) s[k ^ maski] = a0;
+		} else {
+			a0 = it->second;
+			pt = s.find(k | maski);
+			a1 = (pt == s.end()) ? Complex(0) : pt->second;
+			ApplyPair(c, a0, a1, m);
+			it->second = a0;
+			if (pt != s.end())
+				pt->second = a1;
+			else if (norm(a1) > SPARSE_DROP)		//visited later and skipped
+				s.insert(it, QState::SparseArray::value_type(k | maski, a1));
+		}
+	}
+
+	//interference may have cancelled some amplitudes
+	for (it = s.begin(); it != s.end(); )
+		if (norm(it->second) <= SPARSE_DROP)
+			s.erase(it++);
 		else
-			_qArrayTmp[k] = _a00 * q[k] + _a01 * q[k ^ maski];
-       
-		for (k = 0; k < q.Outcomes(); k++)
-			q[k] = _qArrayTmp[k]; //copy result
+			++it;
+}
+
+void SingleBit::operator() (QState &q, int bit=0)
+//in-place application: each amplitude pair (k, k|maski) is read
+//once, multiplied by the gate matrix and written back; no temporary
+//copy of the state is needed. Pairs with the same high bits form
+//contiguous runs which are handed to the kernel matching the gate's
+//GateClass (see kernel.h).
+{
+	QIndex maski  = (QIndex) 1 << bit;	// set bit mask
+	QIndex low    = maski - 1;	// bits below the controlled one
+	QIndex pairs  = q.Outcomes() >> 1;
+	QIndex chunks = (pairs + PAR_CHUNK - 1) / PAR_CHUNK;
+	QIndex c;
+
+	const Complex m[4] = { _a00, _a01, _a10, _a11 };
+	PROFILE(_name, Traffic(q));
+
+	if (q.IsSparse()) {
+		SparseApply(q, 0, maski, _class, m);
+		q.Compact();
+		return;
+	}
+
+	Complex *a = &q[0];
+
+	#pragma omp parallel for schedule(static) if(chunks > 1)
+	for (c = 0; c < chunks; c++) {
+		QIndex p   = c * PAR_CHUNK;
+		QIndex end = (pairs - p < PAR_CHUNK) ? pairs : p + PAR_CHUNK;
+
+		if (bit == 0) {				//pairs are neighbours
+			if (_class == GATE_GENERAL)
+				ApplyAdjacentPairs(a + 2*p, end - p, m);
+			else
+				for ( ; p < end; p++)
+					ApplyPair(_class, a[2*p], a[2*p + 1], m);
+			continue;
+		}
+
+		while (p < end) {
+			QIndex k   = ((p & ~low) << 1) | (p & low);	//insert a 0 at bit
+			QIndex len = maski - (p & low);				//rest of this run
+			if (len > end - p) len = end - p;
+			ApplyRun(_class, a + k, a + (k | maski), len, m);
+			p += len;
+		}
+	}
 }
 
-void Controlled::operator() (QState &q, int mask, int bit=0)
+void Controlled::operator() (QState &q, QIndex mask, int bit=0)
 //multi-controlled (via mask) operator
 //suggested by Rafal Podeszwa
+//
+//The gate acts only where ALL controlling bits are set. Instead of
+//scanning every outcome we enumerate the subsets of the remaining free
+//bits (those neither controlling nor controlled), so for k controls
+//only 2^(n-k-1) amplitude pairs are visited, each updated in place.
+//The free bits below the lowest controlling/controlled bit give
+//contiguous runs for the kernels in kernel.h; runs are grouped into chunks
+//of about PAR_CHUNK pairs for the worker threads.
 {
-	std::vector<Complex> _qArrayTmp(q.Outcomes());
-	int maski = 1 << bit;
-	D("Controlling: %d \t Controlled: %d\n",mask, maski);
-	D("In common: %d\n", mask & maski);
+	QIndex maski = (QIndex) 1 << bit;
+	D("Controlling: %lld \t Controlled: %lld\n",mask, maski);
+	D("In common: %lld\n", mask & maski);
 	assert((mask & maski) == 0); //can't control controlling bit
-	int k;
+	assert((mask | maski) < q.Outcomes());
+
+	QIndex used   = mask | maski;
+	QIndex free   = (q.Outcomes() - 1) & ~used;
+	QIndex len    = used & -used;			//pairs in one contiguous run
+	QIndex upper  = free & ~(len - 1);	//free bits above the run
+	QIndex runs   = ((QIndex) 1 << count_ones(free)) / len;
+	QIndex step   = (PAR_CHUNK > len) ? PAR_CHUNK / len : 1; //runs per chunk
+	QIndex chunks = (runs + step - 1) / step;
+	QIndex c;
+
+	const Complex m[4] = { _a00, _a01, _a10, _a11 };
+	PROFILE(_name, Traffic(q, (QIndex) 1 << count_ones(mask)));
+
+	if (q.IsSparse()) {
+		SparseApply(q, mask, maski, _class, m);
+		q.Compact();
+		return;
+	}
 
-	for(k=0; k < q.Outcomes(); k++) {
-		if (k & mask)           //if mask is set
-			if (k & maski)  //if controlled bit set
-				_qArrayTmp[k] = _a10 * q[k ^ maski] + _a11 * q[k];
+	Complex *a = &q[0];
+
+	#pragma omp parallel for schedule(static) if(chunks > 1)
+	for (c = 0; c < chunks; c++) {
+		QIndex s = deposit_bits(c * step, upper);	//first run of chunk
+		QIndex n = (runs - c * step < step) ? runs - c * step : step;
+
+		for ( ; n > 0; n--) {
+			QIndex k = s | mask;		//all controls set, controlled bit clear
+			if (len == 1)
+				ApplyPair(_class, a[k], a[k | maski], m);
 			else
-				_qArrayTmp[k] = _a00 * q[k] + _a10 * q[k ^ maski];
+				ApplyRun(_class, a + k, a + (k | maski), len, m);
+			s = (s - upper) & upper;	//next run
+		}
+	}
+}
+
+void ApplyGate(Complex *a, int nbits, QIndex mask, int bit, GateClass c,
+					const Complex m[4])
+//same enumeration as Controlled::operator(), on a plain array and on
+//the calling thread only
+{
+	QIndex maski = (QIndex) 1 << bit;
+	QIndex used  = mask | maski;
+	QIndex free  = (((QIndex) 1 << nbits) - 1) & ~used;
+	QIndex len   = used & -used;
+	QIndex upper = free & ~(len - 1);
+	QIndex runs  = ((QIndex) 1 << count_ones(free)) / len;
+	QIndex s = 0;
 
-		if (k & mask)
-			q[k] = _qArrayTmp[k];
+	if (used == 1 && c == GATE_GENERAL) {		//neighbouring pairs
+		ApplyAdjacentPairs(a, runs, m);
+		return;
 	}
+
+	for ( ; runs > 0; runs--) {
+		QIndex k = s | mask;
+		if (len == 1)
+			ApplyPair(c, a[k], a[k | maski], m);
+		else
+			ApplyRun(c, a + k, a + (k | maski), len, m);
+		s = (s - upper) & upper;
+	}
+}
+
+void opFFT::_Twiddles(int numbits)
+//phase of the S gates for target j in terms of the higher bits h is
+//exp(-i*PI*Reverse(h,numbits-1)/2^(numbits-1)); it is split into a
+//product of two small tables for the low and high bits of h
+{
+	if (numbits == _bits) return;		//same tables as last time
+	_bits  = numbits;
+	_split = (numbits - 1) / 2;
+
+	int nlo = 1 << _split, nhi = 1 << (numbits - 1 - _split);
+	double unit = -M_PI / ((QIndex) 1 << (numbits - 1));
+	int i;
+
+	_lo.resize(nlo);
+	_hi.resize(nhi);
+	for (i = 0; i < nlo; i++)
+		_lo[i] = (Complex) polar(1.0, unit * Reverse(i, numbits - 1));
+	for (i = 0; i < nhi; i++)
+		_hi[i] = (Complex) polar(1.0, unit * Reverse((QIndex) i << _split,
+															   numbits - 1));
 }
 
 void opFFT::operator() (QState &q, int numbits=-1)
+//The phase shifts S(j,k), k>j, are all diagonal and commute, so for a
+//fixed j together they just multiply amplitudes with bit j set by one
+//twiddle factor that depends on bits j+1..numbits-1. That factor is
+//constant along a run of pairs, so it is folded with the Hadamard on
+//bit j into a single 2x2 matrix per run: one sweep per bit instead of
+//one per gate. The result is bit-reversed exactly as before.
 { 
 	if (numbits == -1) numbits = q.Qubits();
-   int j,k; 
    assert(numbits>=2); 	//need at least 2 qubits
-  
-	//operators we will be needing
-   opSPhaseShift S;      //conditional phase shift
-   Hadamard H;           //hadamard operator
-	
+	_Twiddles(numbits);
+	PROFILE("FFT", 0);
+
+	int j;
+	QIndex c;
+	QIndex pairs  = q.Outcomes() >> 1;
+	QIndex chunks = (pairs + PAR_CHUNK - 1) / PAR_CHUNK;
+	QIndex lomask = ((QIndex) 1 << _split) - 1;
+	const QReal r = M_SQRT1_2;
+	const Complex H[4] = { r, r, r, -r };
+
    for (j = numbits-1; j>=0; j--) 
    { 
-      for (k = numbits-1; k>j; k--)
-      {
-    		S(q,j,k);		
-		D("S(%d,%d)",j,k);
-      }
-      D("H(%d)",j);
-      H(q,j);
-	
+		QIndex maski = (QIndex) 1 << j;
+		QIndex low   = maski - 1;
+		QIndex hmask = ((QIndex) 1 << (numbits - 1 - j)) - 1;	//bits above j
+
+		D("S(%d,*) H(%d)\n",j,j);
+		PROFILE_BYTES(Traffic(q));
+
+		if (q.IsSparse()) {			//twiddle, then a sparse Hadamard
+			QState::SparseArray &s = q.Sparse();
+			for (QState::SparseArray::iterator it = s.begin();
+				  it != s.end(); ++it)
+				if (it->first & maski) {
+					QIndex h = (it->first >> (j + 1)) & hmask;
+					it->second *= _lo[h & lomask] * _hi[h >> _split];
+				}
+			SparseApply(q, 0, maski, GATE_GENERAL, H);
+			q.Compact();			//may turn dense for the remaining bits
+			continue;
+		}
+
+		Complex *a = &q[0];
+
+		#pragma omp parallel for schedule(static) if(chunks > 1)
+		for (c = 0; c < chunks; c++) {
+			QIndex p   = c * PAR_CHUNK;
+			QIndex end = (pairs - p < PAR_CHUNK) ? pairs : p + PAR_CHUNK;
+			Complex m[4];
+
+			while (p < end) {
+				QIndex k   = ((p & ~low) << 1) | (p & low);
+				QIndex len = maski - (p & low);
+				if (len > end - p) len = end - p;
+
+				QIndex h = (k >> (j + 1)) & hmask;
+				Complex w = _lo[h & lomask] * _hi[h >> _split];
+				m[0] = r;	m[1] =  r * w;
+				m[2] = r;	m[3] = -r * w;
+
+				if (len == 1)
+					ApplyPair(GATE_GENERAL, a[k], a[k | maski], m);
+				else
+					ApplyPairs(a + k, a + (k | maski), len, m);
+				p += len;
+			}
+		}
    } 
 }
+
+void ModExp::operator() (QState &q, QIndex a, QIndex n, int b)
+//Amplitude x only ever moves to x + (a^x mod n << b), whose amplitude
+//is zero, so the whole map is a set of disjoint swaps and only the
+//first register has to be visited. a^x mod n is stepped by one
+//multiplication per x; each chunk starts from one modexp() call.
+{
+	PROFILE("ModExp", 2 * Traffic(q, b < q.Qubits() ? q.Outcomes() >> b : 1));
+
+	if (q.IsSparse()) {
+		//only the nonzero amplitudes move, into a fresh map
+		QState::SparseArray t;
+		QState::SparseArray::const_iterator it;
+		for (it = q.Sparse().begin(); it != q.Sparse().end(); ++it)
+			t[it->first + (modexp(a,it->first,n) << b)] = it->second;
+		q.Sparse().swap(t);
+		return;
+	}
+
+	QIndex first  = ((QIndex) 1 << b) < q.Outcomes() ? (QIndex) 1 << b
+																		: q.Outcomes();
+	QIndex chunks = (first + PAR_CHUNK - 1) / PAR_CHUNK;
+	QIndex c;
+	Complex *amp = &q[0];
+
+	#pragma omp parallel for schedule(static) if(chunks > 1)
+	for (c = 0; c < chunks; c++) {
+		QIndex x   = c * PAR_CHUNK;
+		QIndex end = (first - x < PAR_CHUNK) ? first : x + PAR_CHUNK;
+		QIndex f   = modexp(a, x, n);			//a^x mod n
+
+		for ( ; x < end; x++, f = mulmod(f, a, n))
+			if (f != 0) {
+				Complex t = amp[x];
+				amp[x] = amp[x + (f << b)];
+				amp[x + (f << b)] = t;
+			}
+	}
+
+	q.Compact();
+}
+
+QIndex PeriodComb::operator() (QState &q, QIndex a, QIndex n, QIndex x0)
+//The comb starts at the first x with a^x = a^x0 and its spacing is the
+//distance to the next one. Both are found by stepping a^x, which takes
+//less than 2n multiplications; the register is written in one sweep.
+{
+	QIndex size = q.Outcomes();
+	QIndex y = modexp(a, x0, n);
+	QIndex start = 0, r = 0, f, c;
+
+	assert(0 <= x0 && x0 < size && GCD(a, n) == 1);
+	PROFILE("PeriodComb", size * sizeof(Complex));
+
+	for (f = 1 % n; f != y; f = mulmod(f, a, n)) start++;
+	for (f = mulmod(f, a, n), r = 1; f != y; f = mulmod(f, a, n)) r++;
+
+	QIndex teeth  = (size - 1 - start) / r + 1;
+	QIndex chunks = (size + PAR_CHUNK - 1) / PAR_CHUNK;
+	Complex amp   = 1 / sqrt((double) teeth);
+
+	D("comb: y=%lld start=%lld period=%lld teeth=%lld\n", y, start, r, teeth);
+
+	q.MakeDense();
+	Complex *s = &q[0];
+
+	#pragma omp parallel for schedule(static) if(chunks > 1)
+	for (c = 0; c < chunks; c++) {
+		QIndex x   = c * PAR_CHUNK;
+		QIndex end = (size - x < PAR_CHUNK) ? size : x + PAR_CHUNK;
+
+		std::fill(s + x, s + end, Complex(0));
+		x = (x <= start) ? start : start + (x - start + r - 1) / r * r;
+		for ( ; x < end; x += r) s[x] = amp;
+	}
+
+	q.Compact();
+	return y;
+}
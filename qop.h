@@ -60,6 +60,12 @@ the reusal of a certain gate. Here's an example:
 	Rx.Param(PI/3);		//now it will perform PI/3 rotations
 	Rx(mystate,1);			//the second bit is rotated by PI/3
 
+Every operator also declares the shape of its matrix as a GateClass
+(general, diagonal or anti-diagonal) and hands it to SetMatrix() along
+with the coefficients. Phase gates are diagonal and only rescale one
+or both halves of the state; NOT is anti-diagonal and only swaps
+amplitudes, so neither pays for a full 2x2 multiply.
+
 Multi-controlled means that several bits can be used
 as controlling bits. This also means that the controlling bit 
 argument to the controlled functions is going to be a mask, not just
@@ -100,6 +106,18 @@ WARNING: The following code may be strange, unusual, perhaps
 #include <math.h>
 #include "utility.h"
 #include "qstate.h"
+#include "parallel.h"
+
+enum GateClass
+//: Shape of a gate matrix, used to pick the cheapest kernel.
+// Each operator template below declares its shape at compile time;
+// diagonal gates only rescale amplitudes and anti-diagonal ones
+// (NOT) only exchange them, so neither needs the full 2x2 multiply.
+{
+	GATE_GENERAL,			// dense 2x2 matrix
+	GATE_DIAGONAL,			// a01 == a10 == 0 (phase gates)
+	GATE_ANTIDIAGONAL		// a00 == a11 == 0 (negation)
+};
 
 class SingleBit
 //: Base for one-bit gates.
@@ -108,19 +126,37 @@ public:
 	virtual void operator() (QState &q, int bit);
 
 	void SetMatrix(const Complex &a00, const Complex &a01,
-						const Complex &a10, const Complex &a11)
-		{ _a00 = a00; _a01 = a01; _a10 = a10; _a11 = a11; }	
+						const Complex &a10, const Complex &a11,
+						GateClass c = GATE_GENERAL)
+		{ _a00 = a00; _a01 = a01; _a10 = a10; _a11 = a11; _class = c; }	
+
+	//: Copy the gate matrix, row by row, into m. (used by QCircuit)
+	void GetMatrix(Complex m[4]) const
+		{ m[0] = _a00; m[1] = _a01; m[2] = _a10; m[3] = _a11; }
+
+	//: Shape of the gate matrix.
+	GateClass Shape() const { return _class; }
+
+	//: Name of the gate, as shown by ProfileReport().
+	const char *Name() const { return _name; }
+
+	//: Name the gate; the one-bit name is used here. (see Controlled)
+	void SetName(const char *single, const char *controlled)
+		{ _name = single; }
 
 protected:
 
 	//: Constructor to create gate matrix (Identity by default)
 	SingleBit(const Complex &a00=1, const Complex &a01=0,
-		  	    const Complex &a10=0, const Complex &a11=1)
-			{ SetMatrix(a00,a01,a10,a11); }
+		  	    const Complex &a10=0, const Complex &a11=1,
+				 GateClass c = GATE_GENERAL)
+			: _name("SingleBit") { SetMatrix(a00,a01,a10,a11,c); }
 
 private:
 	
 	Complex _a00, _a01, _a10, _a11;
+	GateClass _class;
+	const char *_name;
 
 };
 
@@ -130,36 +166,65 @@ class Controlled
 public:
   
 	//: Operator for application of gate to a QState.
-	virtual void operator() (QState &q, int mask, int bit);
+	virtual void operator() (QState &q, QIndex mask, int bit);
 
 	//: This version allows bitmask to be specified in an array of int.
 	virtual void operator() (QState &q, int bits[], int bit)
-		{ 	unsigned long mask=CreateMask(bits);
+		{ 	QIndex mask=CreateMask(bits);
 			operator()(q,mask,bit); }
 
         //: Allows reusal of a defined gate by changing its matrix.
 	void SetMatrix(const Complex &a00, const Complex &a01,
-						const Complex &a10, const Complex &a11)
-		{ _a00 = a00; _a01 = a01; _a10 = a10; _a11 = a11; }	
+						const Complex &a10, const Complex &a11,
+						GateClass c = GATE_GENERAL)
+		{ _a00 = a00; _a01 = a01; _a10 = a10; _a11 = a11; _class = c; }	
+
+	//: Copy the gate matrix, row by row, into m. (used by QCircuit)
+	void GetMatrix(Complex m[4]) const
+		{ m[0] = _a00; m[1] = _a01; m[2] = _a10; m[3] = _a11; }
+
+	//: Shape of the gate matrix.
+	GateClass Shape() const { return _class; }
+
+	//: Name of the gate, as shown by ProfileReport().
+	const char *Name() const { return _name; }
+
+	//: Name the gate; the controlled name is used here.
+	// Each operator template names both of its forms, e.g.
+	// "Hadamard" and "CHadamard".
+	void SetName(const char *single, const char *controlled)
+		{ _name = controlled; }
 
 protected:
 	
 	//: Constructor to create gate matrix (Identity Matrix by default)
 	Controlled(const Complex &a00=1, const Complex &a01=0,
- 				  const Complex &a10=0, const Complex &a11=1)
-		{ SetMatrix(a00,a01,a10,a11); }
+ 				  const Complex &a10=0, const Complex &a11=1,
+				  GateClass c = GATE_GENERAL)
+		: _name("Controlled") { SetMatrix(a00,a01,a10,a11,c); }
 
 private:
 	
 	Complex _a00, _a01, _a10, _a11;
+	GateClass _class;
+	const char *_name;
 
 };
 
+//: Apply a (controlled) one-bit gate to a plain array of 2^nbits amplitudes.
+// Runs on the calling thread only; QCircuit uses it on cache sized
+// tiles of a state (see circuit.h).
+void ApplyGate(Complex *a, int nbits, QIndex mask, int bit, GateClass c,
+					const Complex m[4]);
+
 template <class BaseClassT>
 class opUnitary : public BaseClassT
 //: General Unitary operator.
 {
 public:
+	static const GateClass Class = GATE_GENERAL;
+
+	//: theta == 0 leaves only the phases, so the gate is diagonal.
 	void Param(double alpha, double beta, double delta, double theta)
 	{                
 		BaseClassT::SetMatrix
@@ -173,11 +238,13 @@ public:
                         -sin(delta-alpha/2+beta/2)*sin(theta/2)),
 
                 Complex(cos(delta-alpha/2-beta/2)*cos(theta/2),
-                        sin(delta-alpha/2-beta/2)*cos(theta/2)));
+                        sin(delta-alpha/2-beta/2)*cos(theta/2)),
+
+					 sin(theta/2) == 0 ? GATE_DIAGONAL : Class);
  	}
 
 	opUnitary(double a=0, double b=0, double d=0, double t=0)
-		{ Param(a,b,d,t); }
+		{ BaseClassT::SetName("Unitary", "CUnitary"); Param(a,b,d,t); }
 };
 
 template <class BaseClassT>
@@ -185,15 +252,18 @@ class opRotQubit : public BaseClassT
 //: Rotation on y-axis
 {
 public:
+	static const GateClass Class = GATE_GENERAL;
+
 	//: Set the parameters needed for the gate to function.
 	void Param(double theta) {
 		BaseClassT::SetMatrix( 
 			 cos(theta/2),  sin(theta/2),
-			-sin(theta/2),  cos(theta/2)
+			-sin(theta/2),  cos(theta/2), Class
 		);
 	}
 	
-	opRotQubit(double theta=0) { Param(theta); }
+	opRotQubit(double theta=0)
+		{ BaseClassT::SetName("RotQubit", "CRotQubit"); Param(theta); }
 }; 
 
 template <class BaseClassT>
@@ -201,14 +271,17 @@ class opRotPhase : public BaseClassT
 //: Rotation on z-axis
 {
 public:
+	static const GateClass Class = GATE_DIAGONAL;
+
 	void Param(double alpha) {
 		BaseClassT::SetMatrix(
 			Complex(cos(alpha/2), sin(alpha/2)), 0,
-			0, Complex(cos(alpha/2), -sin(alpha/2))
+			0, Complex(cos(alpha/2), -sin(alpha/2)), Class
 		);
 	}
 
-	opRotPhase(double alpha=0) { Param(alpha); }
+	opRotPhase(double alpha=0)
+		{ BaseClassT::SetName("RotPhase", "CRotPhase"); Param(alpha); }
 };
 
 template <class BaseClassT>
@@ -216,14 +289,17 @@ class opPhaseShift : public BaseClassT
 //: Scalar multiplication on z-axis
 {
 public:
-	Param(double delta) {
+	static const GateClass Class = GATE_DIAGONAL;
+
+	void Param(double delta) {
 		BaseClassT::SetMatrix(
 			Complex(cos(delta), sin(delta)),0,
-			0, Complex(cos(delta), sin(delta))
+			0, Complex(cos(delta), sin(delta)), Class
 		);
 	}
 
-	opPhaseShift(double delta=0) { Param(delta); }
+	opPhaseShift(double delta=0)
+		{ BaseClassT::SetName("PhaseShift", "CPhaseShift"); Param(delta); }
 };
 
 template <class BaseClassT>
@@ -231,8 +307,11 @@ class opHadamard : public BaseClassT
 //: Hadamard operator [|0> -> |0> + |1> and |1> -> |0> - |1>]
 {
 public:
+	static const GateClass Class = GATE_GENERAL;
+
 	opHadamard() : BaseClassT(M_SQRT1_2, M_SQRT1_2,
-									  M_SQRT1_2, -M_SQRT1_2) {};
+									  M_SQRT1_2, -M_SQRT1_2, Class)
+		{ BaseClassT::SetName("Hadamard", "CHadamard"); }
 };
 
 template <class BaseClassT>
@@ -240,7 +319,10 @@ class opNOT : public BaseClassT
 //: SingleBit == Pauli negation, Controlled == CNot
 {
 public:
-	opNOT() : BaseClassT(0,1,1,0) {};
+	static const GateClass Class = GATE_ANTIDIAGONAL;
+
+	opNOT() : BaseClassT(0,1,1,0,Class)
+		{ BaseClassT::SetName("Not", "CNot"); }
 };
 
 /*** Below are some gates that are different enough that they are implemented
@@ -248,9 +330,21 @@ public:
 
 class opFFT 
 //: Fast Fourier Transform
+// Applies the same Hadamard and SPhaseShift network as before, but
+// merges all the phase shifts on one bit with its Hadamard into a
+// single sweep using precomputed twiddle factors.
 {
+private:
+	std::vector<Complex> _lo, _hi;	//twiddles for low/high bits
+	int _bits, _split;					//numbits and low bits the tables are for
+
+	void _Twiddles(int numbits);
+
 public:
-	opFFT() {};
+	opFFT() : _bits(0), _split(0) {};
+
+	//: Transform the numbits low qubits. (all of them by default)
+	// The result is left bit-reversed, see Reverse() in utility.h.
 	void operator() (QState &q, int numbits=-1);
 };
 
@@ -271,10 +365,10 @@ public:
 	void operator() (QState &q, int j, int k)
 	{
 		assert(j < k);    //see Shor's paper
-		double delta = M_PI/(1 << (k-j));
-		unsigned long mask;
+		double delta = M_PI/((QIndex) 1 << (k-j));
+		QIndex mask;
 		
-		mask = (1 << j);
+		mask = ((QIndex) 1 << j);
 		
 		//call general unitary controlled gate as suggested by Rafal
 		//instead of the four lines following. (works faster)
@@ -289,23 +383,30 @@ public:
 
 class ModExp
 //: Modular Exponentiation
+// Maps |x>|0> to |x>|a^x mod n>, where x is held in the low b bits.
+// The second register (bits b and up) must be |0> on entry, as in
+// Shor's algorithm; the state is permuted in place.
 {
 public:
 	
 	ModExp() {};
-	void operator() (QState &q, int a, int n, int b) {
-		//results go here first
-		vector<Complex> _qArrayTmp(q.Outcomes()); 
-
-		for(int i = 0; i < q.Outcomes(); i++)
-			{
-				if (q[i] != 0)
-					_qArrayTmp[i + (modexp(a,i,n) << b)] = q[i];
-			}
-
-		for (int k = 0; k < q.Outcomes(); k++)
-			q[k] = _qArrayTmp[k]; //copy resulta
-	}
+	void operator() (QState &q, QIndex a, QIndex n, int b);
+};
+
+class PeriodComb
+//: Shor's first register after ModExp and a measurement of the second.
+// The measured value a^x0 mod n leaves the first register in an equal
+// superposition of the x with a^x = a^x0 mod n, i.e. x = x0 mod r for
+// the order r of a: a comb of period r. This builds that comb straight
+// into q (the first register only, all of its qubits), so the second
+// register and its 2^b-fold larger state are never simulated. x0 must
+// be uniform in [0, q.Outcomes()) to sample the second register with
+// the right probabilities; the returned value is a^x0 mod n.
+{
+public:
+
+	PeriodComb() {};
+	QIndex operator() (QState &q, QIndex a, QIndex n, QIndex x0);
 };
 
 template <class OperatorType>
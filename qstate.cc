@@ -24,6 +24,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 #include "qstate.h"
+#include "profile.h"
 
 /* collapse code contributed by Rafal Podeszwa */
 
@@ -31,167 +32,432 @@ void QState::SetState(const std::vector<Complex> &c)
 {
 	double totalprob=0;
 	
-	for(int i=0; i<_nStates; i++)
+	for(QIndex i=0; i<_nStates; i++)
 		{ totalprob+= norm(c[i]); } 
 
 	D("Sum of probabilities: %1.25f\n",totalprob);
 	assert(1-ROUND_ERR <= totalprob && totalprob <= 1+ROUND_ERR );
 
-	for(int j=0; j<_nStates; j++) 
+	for(QIndex j=0; j<_nStates; j++) 
 		_qArray[j] = c[j];
+
+	Compact();
 }
 
-int QState::_Collapse()
-//collapse entire register
+void QState::_Reset()
+{
+	if (_mode == STORE_SPARSE || (_mode == STORE_AUTO && _nStates >= SPARSE_MIN)) {
+		_qArray.release();						//release dense storage
+		_sArray.clear();
+		_sArray[0] = Complex(1);
+		_sparse = true;
+	} else {
+		_sArray.clear();
+		_Clear();
+		_qArray[0] = Complex(1);
+		_sparse = false;
+	}
+}
+
+void QState::SetStorage(StorageMode mode)
+{
+	_mode = mode;
+	if (mode == STORE_DENSE) MakeDense();
+	else if (mode == STORE_SPARSE) MakeSparse();
+	else Compact();
+}
+
+void QState::MakeDense()
+{
+	if (!_sparse) return;
+	D("Converting %lld nonzero amplitudes to dense storage\n",
+	  (QIndex) _sArray.size());
+
+	_qArray.assign(_nStates, Complex(0));
+	for (SparseArray::const_iterator it = _sArray.begin();
+		  it != _sArray.end(); ++it)
+		_qArray[it->first] = it->second;
+
+	_sArray.clear();
+	_sparse = false;
+}
+
+void QState::MakeSparse()
+{
+	if (_sparse) return;
+	D("Converting to sparse storage\n");
+
+	_sArray.clear();
+	for (QIndex i = 0; i < _nStates; i++)
+		if (real(_qArray[i]) || imag(_qArray[i]))
+			_sArray.insert(_sArray.end(), SparseArray::value_type(i, _qArray[i]));
+
+	_qArray.release();
+	_sparse = true;
+}
+
+bool QState::Share(const char *name)
+{
+	MakeDense();
+	_mode = STORE_DENSE;
+	if (!_qArray.Share(name, _nQubits)) {
+		cerr << "ERROR: could not share state as " << name << endl;
+		return false;
+	}
+	return true;
+}
+
+bool QState::Attach(const char *name)
+{
+	int n = _qArray.Attach(name);
+	if (!n) {
+		cerr << "ERROR: no shared state " << name << endl;
+		return false;
+	}
+
+	_nQubits = n;
+	_nStates = (QIndex) 1 << n;
+	_sArray.clear();
+	_sparse = false;
+	_mode = STORE_DENSE;
+	return true;
+}
+
+void QState::Compact()
+{
+	if (_mode != STORE_AUTO || _nStates < SPARSE_MIN) return;
+
+	if (_sparse) {
+		if ((QIndex) _sArray.size() > _nStates / DENSE_FILL) MakeDense();
+	} else if (NonZero() < _nStates / SPARSE_FILL)
+		MakeSparse();
+}
+
+QIndex QState::NonZero(double eps) const
+{
+	QIndex n = 0, i;
+
+	if (_sparse) {
+		for (SparseArray::const_iterator it = _sArray.begin();
+			  it != _sArray.end(); ++it)
+			if (fabs(real(it->second)) > eps || fabs(imag(it->second)) > eps)
+				n++;
+		return n;
+	}
+
+	#pragma omp parallel for reduction(+:n) if(_nStates > PAR_CHUNK)
+	for (i = 0; i < _nStates; i++)
+		if (fabs(real(_qArray[i])) > eps || fabs(imag(_qArray[i])) > eps)
+			n++;
+	return n;
+}
+
+QIndex QState::NextNonZero(QIndex i) const
+{
+	if (_sparse) {
+		SparseArray::const_iterator it = _sArray.lower_bound(i);
+		return it == _sArray.end() ? _nStates : it->first;
+	}
+
+	for ( ; i < _nStates; i++)
+		if (real(_qArray[i]) || imag(_qArray[i])) break;
+	return i;
+}
+
+Complex QState::Amp(QIndex index) const
+{
+	if (!_sparse) return _qArray[index];
+
+	SparseArray::const_iterator it = _sArray.find(index);
+	return it == _sArray.end() ? Complex(0) : it->second;
+}
+
+double norm(const QState &q)
+{
+	if (q._sparse) {
+		QAccum n = 0.0;
+		for (QState::SparseArray::const_iterator it = q._sArray.begin();
+			  it != q._sArray.end(); ++it)
+			n += norm(it->second);
+		return n;
+	}
+
+	QIndex chunks = (q._nStates + PAR_CHUNK - 1) / PAR_CHUNK;
+	std::vector<QAccum> part(chunks);	//partial sum of each chunk
+	QIndex c;
+
+	#pragma omp parallel for schedule(static) if(chunks > 1)
+	for (c = 0; c < chunks; c++) {
+		QIndex end = (c + 1) * PAR_CHUNK < q._nStates ? (c + 1) * PAR_CHUNK
+																	 : q._nStates;
+		QAccum n = 0.0;
+		for (QIndex i = c * PAR_CHUNK; i < end; i++)
+			n += norm(q._qArray[i]);
+		part[c] = n;
+	}
+
+	QAccum n = 0.0;
+	for (c = 0; c < chunks; c++)
+		n += part[c];
+	return n;
+}
+
+QIndex QState::_Pick()
+//draw an outcome of a dense state without changing it.
 //this is an implementation of "Bernhard's Collapse"
 //as suggested by Peter Belkner
+//
+//The probabilities of every chunk are summed in parallel, the chunk
+//holding the random point is found from the partial sums, and only
+//that chunk is scanned amplitude by amplitude.
 {
-	double x=0.0;
-	double rnd = RNG->GetRandBetween(0,norm(*this));
+	QIndex chunks = (_nStates + PAR_CHUNK - 1) / PAR_CHUNK;
+	Workspace::Frame f(_scratch);
+	QAccum *part = f.Get<QAccum>(chunks);
+	QIndex c;
+
+	#pragma omp parallel for schedule(static) if(chunks > 1)
+	for (c = 0; c < chunks; c++) {
+		QIndex end = (c + 1) * PAR_CHUNK < _nStates ? (c + 1) * PAR_CHUNK
+																 : _nStates;
+		QAccum n = 0.0;
+		for (QIndex i = c * PAR_CHUNK; i < end; i++)
+			n += norm(_qArray[i]);
+		part[c] = n;
+	}
 
-	RandGenerator<int> *INTRNG = new IntUniformRandGenerator;
-	unsigned long start = INTRNG->GetRandBetween(0,_nStates);
-	unsigned long i=start;
-	D("Normalized amplitudes: %f\n",norm(*this));
-	
+	QAccum total = 0.0;
+	for (c = 0; c < chunks; c++)
+		total += part[c];
+
+	double rnd = RNG->GetRandBetween(0,total);
+	D("Normalized amplitudes: %f\n",total);
 	D("Collapsing register. Got rnd %1.5f\n", rnd);
-	
-	while ((x += norm(_qArray[i])) < rnd) {
-		if(++i == _nStates)
-			i=0;
-		
-		if (start==i) {
-			//this should never happen
-			cerr << "Unexpected error #7891\n";
-			i = (0 == i) ? _nStates - 1 : i - 1;
-			break;
-		}
-	}
-	
-	int result=i;
-	D("Set register state to %d\n", result);
+
+	double x=0.0;
+	for (c = 0; c < chunks - 1 && x + part[c] < rnd; c++)
+		x += part[c];
+
+	QIndex i   = c * PAR_CHUNK;
+	QIndex end = (c + 1) * PAR_CHUNK < _nStates ? (c + 1) * PAR_CHUNK : _nStates;
+	while ((x += norm(_qArray[i])) < rnd && i < end - 1)
+		i++;
+
+	//skip zero amplitudes left over from rounding
+	while (norm(_qArray[i]) == 0 && i > 0)
+		i--;
+
+	return i;
+}
+
+QIndex QState::_Collapse()
+//collapse entire register
+{
+	PROFILE("Measure", 2.0 * sizeof(Complex) * (_sparse ? _sArray.size() : _nStates));
+	if (_sparse) return _CollapseSparse();
+
+	QIndex result = _Pick(), i;
+	D("Set register state to %lld\n", result);
 
 	/* added by Yan Pritzker -- set all other coefs to 0 since
 		qubit is collapsed; set collapsed state to prob 1 */
 
-	for(int i=0; i < _nStates; i++) _qArray[i]=0;
+	#pragma omp parallel for if(_nStates > PAR_CHUNK)
+	for(i=0; i < _nStates; i++) _qArray[i]=0;
 	_qArray[result]=1;
 
+	Compact();
+	return result;
+}
+
+QIndex QState::_CollapseSparse()
+//collapse entire register stored as a map of nonzero amplitudes
+{
+	SparseArray::iterator it;
+	QAccum total = 0.0;
+
+	for (it = _sArray.begin(); it != _sArray.end(); ++it)
+		total += norm(it->second);
+
+	double rnd = RNG->GetRandBetween(0,total);
+	double x = 0.0;
+	QIndex result = _sArray.rbegin()->first;	//in case of rounding
+
+	for (it = _sArray.begin(); it != _sArray.end(); ++it)
+		if ((x += norm(it->second)) >= rnd) {
+			result = it->first;
+			break;
+		}
+
+	D("Set register state to %lld\n", result);
+	_sArray.clear();
+	_sArray[result] = 1;
 	return result;
 }
 
 int QState::_Collapse(int index)
 //single qubit collapse
 {
-	//index is 0..nQubits-1, 0 being the most significant qubit,
-	//e.g. in |0001>, the 1 is the least significant qubit and
-	//its position is nQubits-1
 	assert(0 <= index && index < _nQubits);	
+	return _CollapseSet((QIndex) 1 << index) ? 1 : 0;
+}
 
-	double p0,p1;	//probabilities of measuring this bit as 0 and 1
-	p0=p1=0.0;
-	
-	for (int i=0; i < _nStates; i++) {
-		if (IsBitSet(i,index))
-			p1 += norm(_qArray[i]);
-		else
-			p0 += norm(_qArray[i]);
+//a set of up to SET_TABLE_BITS bits is measured from a table of the
+//joint probabilities of all its values, summed over at most
+//SET_SEGMENTS pieces of the state (a fixed number, so the sums don't
+//depend on the number of threads)
+static const int SET_TABLE_BITS = 10;
+static const QIndex SET_SEGMENTS = 256;
+
+QIndex QState::_CollapseSet(QIndex bits)
+//measure every bit in the mask at once. With few bits, one sweep sums
+//the probability of each of their joint values, one value is drawn and
+//a second sweep projects onto it and renormalizes with a precomputed
+//1/sqrt(p). With more bits a whole outcome is drawn instead (its bits
+//have the right joint distribution), p is summed over the amplitudes
+//that agree with it and those are rescaled.
+{
+	assert(bits > 0 && bits < _nStates);
+	PROFILE("MeasureSet", 2.0 * sizeof(Complex) * (_sparse ? _sArray.size() : _nStates));
+	if (_sparse) return _CollapseSetSparse(bits);
+
+	int nbits = count_ones(bits);
+	QIndex result, i;
+	QAccum p = 0.0;
+
+	if (nbits <= SET_TABLE_BITS) {
+		QIndex values = (QIndex) 1 << nbits;
+		QIndex seg = _nStates / SET_SEGMENTS;
+		if (seg < PAR_CHUNK) seg = PAR_CHUNK < _nStates ? PAR_CHUNK : _nStates;
+		QIndex segs = _nStates / seg;
+		QIndex run  = seg < PAR_CHUNK ? seg : PAR_CHUNK;
+		QIndex s, v;
+
+		Workspace::Frame f(_scratch);
+		int *low = f.Get<int>(run);
+		QAccum *part = f.Get<QAccum>(segs * values);
+		QAccum *prob = f.Get<QAccum>(values);
+
+		//value of the bits for the low bits of an index
+		for (i = 0; i < run; i++)
+			low[i] = extract_bits(i & bits, bits);
+		std::fill(part, part + segs * values, 0.0);
+		std::fill(prob, prob + values, 0.0);
+
+		#pragma omp parallel for schedule(static) if(segs > 1)
+		for (s = 0; s < segs; s++) {
+			QAccum *t = &part[s * values];
+			for (QIndex b = s * seg; b < (s + 1) * seg; b += run) {
+				int high = extract_bits(b & bits, bits);
+				const Complex *a = &_qArray[b];
+				for (QIndex j = 0; j < run; j++)
+					t[high | low[j]] += norm(a[j]);
+			}
 		}
 
-	D("Got probabilities...p0=%1.3f, p1=%1.3f\n", p0, p1);
-   D("Sum of probabilities: %1.5f; Normalized amplitudes: %1.5f\n",
-		 p0+p1, norm(*this));
-	
-	//sum of normalized amplitudes and sum of added probabilities
-	//should equal..if not we messed up somewhere in the addition/normalization
-	D("norm(*this) + ROUND_ERR = %1.25f\n", norm(*this) + ROUND_ERR);
-	D("norm(*this) - ROUND_ERR = %1.25f\n", norm(*this) - ROUND_ERR);
-	D("p0+p1 should be between those and it is %1.10f\n", p0+p1);
-	assert( 	p0+p1 <= norm(*this) + ROUND_ERR &&
-				p0+p1 >= norm(*this) - ROUND_ERR);
-
-	double rnd=RNG->GetRandBetween(0,norm(*this));
-	bool on  = p0 < rnd;
-	
-	for (int i=0;i < _nStates; i++) 
-		if (IsBitSet(i,index))
-   		if(!on) _qArray[i] = 0.0;
-			else _qArray[i] /= sqrt(p1);
+		QAccum total = 0.0;
+		for (s = 0; s < segs; s++)
+			for (v = 0; v < values; v++)
+				prob[v] += part[s * values + v];
+		for (v = 0; v < values; v++)
+			total += prob[v];
+
+		double rnd = RNG->GetRandBetween(0,total), x = 0.0;
+		QIndex pick = -1;
+		for (v = 0; v < values; v++)
+			if (prob[v] > 0) {
+				pick = v;					//last possible value, for rounding
+				if ((x += prob[v]) >= rnd) break;
+			}
+
+		result = deposit_bits(pick, bits);
+		p = prob[pick];
+	} else {
+		result = _Pick() & bits;
+
+		QIndex chunks = (_nStates + PAR_CHUNK - 1) / PAR_CHUNK;
+		Workspace::Frame f(_scratch);
+		QAccum *part = f.Get<QAccum>(chunks);
+		QIndex c;
+
+		#pragma omp parallel for schedule(static) if(chunks > 1)
+		for (c = 0; c < chunks; c++) {
+			QIndex end = (c + 1) * PAR_CHUNK < _nStates ? (c + 1) * PAR_CHUNK
+																	 : _nStates;
+			QAccum n = 0.0;
+			for (QIndex i = c * PAR_CHUNK; i < end; i++)
+				if ((i & bits) == result)
+					n += norm(_qArray[i]);
+			part[c] = n;
+		}
+		for (c = 0; c < chunks; c++)
+			p += part[c];
+	}
+
+	D("Measured bits %llX as %llX, p=%f\n", bits, result, (double) p);
+
+	QReal scale = 1 / sqrt(p);
+
+	#pragma omp parallel for schedule(static) if(_nStates > PAR_CHUNK)
+	for (i = 0; i < _nStates; i++)
+		if ((i & bits) == result)
+			_qArray[i] *= scale;
 		else
-			if(on) _qArray[i] = 0.0;
-			else _qArray[i] /= sqrt(p0);
-	
-	D("Set bit state to %d\n", on);
-	return on;
+			_qArray[i] = 0;
+
+	Compact();
+	return result;
 }
 
-int QState::_CollapseSet(unsigned long bits)
+QIndex QState::_CollapseSetSparse(QIndex bits)
+//set collapse of a sparse state: draw a stored outcome, keep the ones
+//that agree with it on bits and renormalize those
 {
-	int i; 
-	int state=0;
+	SparseArray::iterator it;
+	QAccum total = 0.0, p = 0.0;
 
-	for (i = 0; i < _nQubits; i++)
-		if ((1 << i) & bits) 
-			state += _Collapse(i);
+	for (it = _sArray.begin(); it != _sArray.end(); ++it)
+		total += norm(it->second);
 
-	return state;
-}
+	double rnd = RNG->GetRandBetween(0,total), x = 0.0;
+	QIndex result = _sArray.rbegin()->first & bits;		//in case of rounding
 
-void QState::PrintSTD() const
-{
-	static const char* withimag		= "(%1.6f,%1.6f) |%s>";
-	static const char* withimag_last	= "(%1.6f,%1.6f) |%s>\n";
-	static const char* noimag			= "%1.6f |%s>";
-	static const char* noimag_last	= "%1.6f |%s>\n";
-   
-	int nonzero=0;	//number of nonzero probability states (for plus sign)
-	for( int i=0; i < _nStates; i++ ) 
-		if(real(_qArray[i]) || imag(_qArray[i])) nonzero++;
+	for (it = _sArray.begin(); it != _sArray.end(); ++it)
+		if ((x += norm(it->second)) >= rnd) {
+			result = it->first & bits;
+			break;
+		}
 
-	int pad=count_bits(_nStates-1);
+	for (it = _sArray.begin(); it != _sArray.end(); )
+		if ((it->first & bits) != result)
+			_sArray.erase(it++);
+		else
+			p += norm((it++)->second);
 
-	for(int i=0; i < _nStates-1; i++) {
-      if(!imag(_qArray[i]) && !real(_qArray[i])) { continue; }
-		if(imag(_qArray[i])) {
-         printf(	withimag,
-               	real(_qArray[i]),
-               	imag(_qArray[i]),
-               	dtob(i,pad));
-      } else {
-         printf(noimag, real(_qArray[i]), dtob(i,pad));
-   	}
-		if(--nonzero) { printf(" + "); } 
-	}
- 
-   if(!imag(_qArray[_nStates-1]) && !real(_qArray[_nStates-1])) 
-		{ printf("\n"); return; }
-	if(imag(_qArray[_nStates-1])) {
-		 printf ( withimag_last,
-               real(_qArray[_nStates-1]),
-               imag(_qArray[_nStates-1]),
-               dtob(_nStates-1,pad));
-   } else {
-      printf ( noimag_last,
-               real(_qArray[_nStates-1]),
-               dtob(_nStates-1,pad));
-	}
-	printf("\n");
+	QReal scale = 1 / sqrt(p);
+	for (it = _sArray.begin(); it != _sArray.end(); ++it)
+		it->second *= scale;
+
+	D("Measured bits %llX as %llX\n", bits, result);
+	return result;
 }
 
 void QState::Dump(char filename[]) const
 {
 	FILE *FH;
-	if ((FH=fopen(filename,"w"))==NULL)
+	if ((FH=fopen(filename,"w"))==NULL) {
 		cerr << "ERROR: could not open file " << filename << endl;
+		return;
+	}
 
-	fprintf(FH,"QSTATE SIZE %d\n", _nStates);
+	fprintf(FH,"QSTATE SIZE %lld\n", _nStates);
 
-	for(int i=0; i < _nStates; i++) {
-		if(real(_qArray[i]) || imag(_qArray[i]))
-			fprintf(FH, "%+1.17f \t %+1.17f \t |0x%X>\n",
-					 real(_qArray[i]),
-					 imag(_qArray[i]),
-					 i);
+	for(QIndex i = NextNonZero(0); i < _nStates; i = NextNonZero(i+1)) {
+		Complex c = Amp(i);
+		fprintf(FH, "%+1.17f \t %+1.17f \t |0x%llX>\n",
+				 (double) real(c),
+				 (double) imag(c),
+				 i);
 	}
 	fclose(FH);
 }
@@ -200,28 +466,30 @@ void QState::Read(char filename[])
 {
 	FILE *FH;
 	
-	if((FH=fopen(filename,"r"))==NULL)
+	if((FH=fopen(filename,"r"))==NULL) {
 		cerr << "ERROR: could not open file " << filename << endl;
+		return;
+	}
 
 	double real,imag;
-	int index;
-	int size;
+	QIndex index;
+	QIndex size = 0;
 
-	fscanf(FH, "QSTATE SIZE %d\n", &size);
+	MakeDense();
+	fscanf(FH, "QSTATE SIZE %lld\n", &size);
 	assert(this->_nStates==size);
+	_Clear();							//only nonzero amplitudes are listed
 	
-	while(FH)
+	//Dump writes "%+1.17f", which scanf reads back as a plain %lf
+	while(fscanf(FH,"%lf \t %lf \t |0x%llX>\n", &real, &imag, &index) == 3)
 	{
-		int r=fscanf(FH,"%+1.17f \t %+1.17f \t |0x%X>\n", 
-					 	 &real, &imag, &index);
-
-		if(r==0) break;
-
-		D("Scanned %f %f %d\n",real,imag,index);
+		D("Scanned %f %f %lld\n",real,imag,index);
+		assert(0 <= index && index < _nStates);
 		_qArray[index] = Complex(real,imag);
 	}
 
 	fclose(FH);
 	D("Error: %f",norm(*this));
 	assert(1-ROUND_ERR <= norm(*this) && norm(*this) <= 1+ROUND_ERR);
+	Compact();
 }
@@ -34,17 +34,47 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "complex.h"					//complex numbers
 #include "debug.h"					//debugging stuff
 #include "random.h"					//random number generator
+#include "parallel.h"					//worker threads
+#include "storage.h"					//heap or shared amplitude arrays
 
 #define _RNGT_ double						//what type of generator
-#define _RNG_  DblUniformRandGenerator	//specifically what type
+#define _RNG_  PhiloxRandGenerator		//specifically what type
  
 //i think an error in the 12th decimal place is reasonable
 //to accept as a rounding error, and not something important
 //e.g. when adding norm(sqrt(1/2)) + norm(sqrt(1/2)) the answer 
 //deviates from 1 by about 2e-16
 
+//single precision only carries about 7 digits, so the tolerance is
+//widened accordingly when amplitudes are floats
+
 //: Acceptable rounding error when normalizing.
+#ifdef Q_SINGLE
+static const double ROUND_ERR = 1e-5;
+#else
 static const double ROUND_ERR = 1e-12;
+#endif
+
+//a register is stored either as a dense array of all 2^n amplitudes or,
+//when most of them are zero (e.g. Shor's register after ModExp), as a
+//map of the nonzero ones only. In STORE_AUTO mode the state switches
+//between the two by fill ratio, with some hysteresis so it doesn't
+//flip back and forth.
+
+//: How a QState chooses between dense and sparse storage.
+enum StorageMode { STORE_AUTO, STORE_DENSE, STORE_SPARSE };
+
+//: Registers with fewer outcomes than this are always dense.
+static const int SPARSE_MIN = 1 << 16;
+
+//: Go sparse when fewer than 1/SPARSE_FILL of the amplitudes are nonzero...
+static const int SPARSE_FILL = 64;
+
+//: ...and back to dense when more than 1/DENSE_FILL are.
+static const int DENSE_FILL = 8;
+
+//: Sparse states drop amplitudes with a probability below this.
+static const double SPARSE_DROP = ROUND_ERR * ROUND_ERR;
 
 //! author = "Yan Pritzker, Peter Belkner, Rafal Podeszwa, Chris Dawson"
 //! lib = "Quantum State [OpenQubit Core]"
@@ -52,20 +82,34 @@ static const double ROUND_ERR = 1e-12;
 class QState 
 //: Model of a quantum state/register
 {
+public:
+	//: Nonzero amplitudes of a sparse state, by outcome.
+	typedef std::map<QIndex, Complex> SparseArray;
+
 private:
-	std::vector<Complex> _qArray;		//: array of complex amplitudes
+	AmpArray _qArray;						//: array of complex amplitudes
+	SparseArray _sArray;					//: nonzero amplitudes when sparse
 	RandGenerator<_RNGT_> *RNG;		//: random number generator
 	
 	int _nQubits;							//: number of qubits
-	int _nStates;							//: number of states = 2^nQubits
+	QIndex _nStates;						//: number of states = 2^nQubits
+	bool _sparse;							//: state lives in _sArray
+	StorageMode _mode;					//: dense/sparse policy
+	Workspace _scratch;					//: temporaries of measurements
 
-	int _Collapse();						//: collapse entire register
+	QIndex _Pick();						//: random outcome, state unchanged
+	QIndex _Collapse();					//: collapse entire register
 	int _Collapse(int);					//: collapse a certain qubit
-	int _CollapseSet(unsigned long);//: collapse a set of bits
+	QIndex _CollapseSet(QIndex);		//: collapse a set of bits
+	QIndex _CollapseSparse();			//: the above for sparse storage
+	QIndex _CollapseSetSparse(QIndex);
 
 	//: creates a state with no coefficients
 	void _Clear()
-		{ for(int i=0; i<_nStates; i++) _qArray[i]=0; }
+		{ _qArray.assign(_nStates, Complex(0)); }
+
+	//: base state |00...0>, sparse if the policy allows it
+	void _Reset();
 	
 	//: initialize array of complex amplitudes
 	void _init(const std::vector<Complex> &c)
@@ -79,17 +123,22 @@ public:
 	
 	//: Default constructor. (Create one qubit)
 	QState()
-		: _nQubits(1), _nStates(1), _qArray(1)
+		: _nQubits(1), _nStates(1), _qArray(1),
+		  _sparse(false), _mode(STORE_AUTO)
 		{ _qArray[0]=sqrt(1.0/2.0); }
 
-	//: Coefficients not specified. Set up Walsh-Hadamard state (1/sqrt(size)).
-	QState(int size)
-		: _nQubits(size), _nStates(1 << size), _qArray(1 << size)
+	//: Coefficients not specified. Set up base state |00...0>.
+	// Large registers start out sparse, so no 2^size array is allocated.
+	QState(int size, StorageMode mode = STORE_AUTO)
+		: _nQubits(size), _nStates((QIndex) 1 << size),
+		  _sparse(false), _mode(mode)
 		{ assert(size>=1); _default_init(); }
 
 	//: Constructor with initialization to complex amplitude array.
 	QState(int size, const std::vector<Complex> &c) 
-		: _nQubits(size), _nStates(1 << size), _qArray(1 << size)
+		: _nQubits(size), _nStates((QIndex) 1 << size),
+		  _qArray((QIndex) 1 << size),
+		  _sparse(false), _mode(STORE_AUTO)
 		{ assert(size>=1); _init(c); }
 
 	//: Default destructor.
@@ -108,22 +157,84 @@ public:
 	//: Same as above.
 	friend ostream& operator<<(ostream&, const QState&);
 
+	//: Only the top most probable outcomes, and only those with
+	// probability >= threshold. Printed most probable first, or in
+	// outcome order if top is 0. [does not disturb state]
+	void Print(ostream &out, QIndex top, double threshold = 0.0) const;
+
 	//: Dump state to file. (Oemer-like Format) [does not disturb state]
+	// One line of text per nonzero amplitude; use Save() for checkpoints.
 	void Dump(char filename[]) const;
 	
 	//: Read state from file. [convenience function]
 	void Read(char filename[]);	
 
+	//: Write a binary snapshot. (see snapshot.h) [does not disturb state]
+	bool Save(const char *filename) const;
+
+	//: Restore a snapshot written by Save(), including its size.
+	// Returns false (and leaves the state alone) if the file is not a
+	// valid snapshot or its checksum does not match.
+	bool Load(const char *filename);
+
+	//: Keep the amplitudes in a named segment that other processes can
+	// Attach(). (see storage.h) The state stays dense from now on.
+	bool Share(const char *name);
+
+	//: Look at a state another process Share()d, without a copy.
+	// Takes the size of the shared state.
+	bool Attach(const char *name);
+
+	//: Let processes waiting in Acquire() look; returns when they're done.
+	void Publish() { _qArray.Publish(); }
+
+	//: Wait until the sharing process is between gates, keep it there.
+	uint64_t Acquire() { return _qArray.Acquire(); }
+
+	//: Let the sharing process go on.
+	void Release() { _qArray.Release(); }
+
+	//: Make measurements reproducible. (0,0 = seed from the clock)
+	void Seed(unsigned int seedVal, unsigned int seedVal2 = 0)
+		{ RNG->Seed(seedVal, seedVal2); }
+
 	//: Returns total number of outcomes.
-	int  Outcomes() const { return _nStates; }	
+	QIndex Outcomes() const { return _nStates; }	
 
 	//: Returns total number of bits.
 	int  Qubits() const { return _nQubits; }
 
+	//: True while only the nonzero amplitudes are stored.
+	bool IsSparse() const { return _sparse; }
+
+	//: Choose dense, sparse or automatic storage.
+	void SetStorage(StorageMode mode);
+
+	//: Convert to dense storage.
+	void MakeDense();
+
+	//: Convert to sparse storage. (drops exactly zero amplitudes)
+	void MakeSparse();
+
+	//: In STORE_AUTO mode switch layout if the fill ratio calls for it.
+	// Cheap for a sparse state; a dense one needs a counting pass.
+	void Compact();
+
+	//: Nonzero amplitudes of a sparse state. (for gate kernels)
+	SparseArray& Sparse() { return _sArray; }
+
+	//: Number of amplitudes with real or imaginary part above eps.
+	QIndex NonZero(double eps = 0.0) const;
+
+	//: First outcome >= i with a nonzero amplitude. (Outcomes() if none)
+	QIndex NextNonZero(QIndex i) const;
+
+	//: Amplitude of an outcome, in either layout. [does not disturb state]
+	Complex Amp(QIndex index) const;
+
 	//: Reset to base state |00...0>.
 	friend void Reset(QState &q) 
-		{ q._Clear();
-		  q._qArray[0] = Complex(1); }
+		{ q._Reset(); }
 
 	//: Destructive register measure.
 	// Note that the collapsing functions do not return another
@@ -134,7 +245,7 @@ public:
 	// at collapses. After the collapse all the coefficients are
 	// set to 0 except for that of the state that the register
 	// collapsed to.
-	friend long Measure(QState &q)
+	friend QIndex Measure(QState &q)
 		{ return q._Collapse(); }
 
 	//: Destructive bit measure.
@@ -142,24 +253,27 @@ public:
 		{ return q._Collapse(i); }
 
 	//: Destructive measure of a set of bits.
-	friend int MeasureSet(QState &q, unsigned long bits)
-		{ q._CollapseSet(bits); }
+	// All bits are measured together in two sweeps over the state. The
+	// result has the measured values in place, i.e. it is the outcome
+	// of a full Measure() masked with bits.
+	friend QIndex MeasureSet(QState &q, QIndex bits)
+		{ return q._CollapseSet(bits); }
 
 	//: Sum of normalized amplitudes. 
-	friend double norm(const QState &q)
-		{ 	double n=0.0;
-			for(int i=0; i<q._nStates; i++)
-				n += norm(q._qArray[i]);
-			return n;
-		}
+	// Summed chunk by chunk so the result does not depend on the
+	// number of threads.
+	friend double norm(const QState &q);
 
 	//: Implicit conversion operator causes destructive measure.
 	operator long()
 		{ return Measure(*this); }
 
 	//: Access to coefficients.
-	Complex& operator[] (int index)
-		{ return _qArray[index]; }
+	// A sparse state is converted to dense storage first; use Amp()
+	// or NextNonZero() to read one without doing so.
+	Complex& operator[] (QIndex index)
+		{ if (_sparse) MakeDense();
+		  return _qArray[index]; }
 
 };
 
@@ -32,6 +32,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <stdlib.h>
 #include <limits.h>
 #include <float.h>
+#include <stdint.h>
 
 //! author="Joe Nelson" 
 //! lib="RandLib"
@@ -241,4 +242,173 @@ protected:
 	{ return static_cast<int>(_inner->GetRandBetween(0, maxVal)); }
 };
 
+/*
+
+The generators below are counter based (Philox4x32-10, Salmon et al.,
+"Parallel random numbers: as easy as 1, 2, 3", SC 2011): the n-th
+number of a stream is a fixed function of (key, stream, n), so there
+is no state to share between threads. Split(s) gives the generator of
+stream s under the same key, e.g. one per thread, chunk or shot:
+
+	PhiloxRandGenerator rng(1234);		//reproducible key
+	#pragma omp parallel for
+	for (c = 0; c < chunks; c++) {
+		PhiloxRandGenerator g = rng.Split(c);
+		...g.Uniform()...
+	}
+
+and the numbers each chunk sees don't depend on which thread ran it.
+A key of 0 is made from the clock and a process-wide count, so two
+generators created in the same second still differ, and so do all
+their splits.
+
+*/
+
+//: Philox4x32-10 block function: encrypt counter ctr with key.
+inline void Philox4x32(uint32_t ctr[4], const uint32_t key[2])
+{
+	uint32_t k0 = key[0], k1 = key[1];
+
+	for (int r = 0; r < 10; r++) {
+		uint64_t p0 = (uint64_t) 0xD2511F53 * ctr[0];
+		uint64_t p1 = (uint64_t) 0xCD9E8D57 * ctr[2];
+		uint32_t c0 = (uint32_t) (p1 >> 32) ^ ctr[1] ^ k0;
+		uint32_t c2 = (uint32_t) (p0 >> 32) ^ ctr[3] ^ k1;
+		ctr[1] = (uint32_t) p1;
+		ctr[3] = (uint32_t) p0;
+		ctr[0] = c0;
+		ctr[2] = c2;
+		k0 += 0x9E3779B9;
+		k1 += 0xBB67AE85;
+	}
+}
+
+//: A number no other clock-seeded generator in this process has had.
+inline uint64_t NextRandStream()
+{
+	static uint64_t next = 0;
+#ifdef __GNUC__
+	return __sync_fetch_and_add(&next, 1);
+#else
+	return next++;
+#endif
+}
+
+class PhiloxRandGenerator : public RandGenerator<double>
+//: Counter-based double RNG (Philox4x32-10), uniform on [0,1) * range
+// Each 128-bit block gives two doubles with 53 random bits. Besides
+// the RandGenerator interface it has non-virtual Uniform() and Fill()
+// for inner loops.
+{
+public:
+	//: key 0 = seed from the clock.
+	PhiloxRandGenerator(const uint64_t key = 0, const uint64_t stream = 0)
+	{ _Set(key, stream); }
+
+	//: The 32-bit halves of the key. (0,0 = from the clock)
+	virtual void Seed(const unsigned int seedVal, const unsigned int seedVal2)
+	{ _Set(((uint64_t) seedVal2 << 32) | seedVal, 0); }
+
+	//: Generator for another stream under the same key, at its start.
+	PhiloxRandGenerator Split(const uint64_t stream) const
+	{ return PhiloxRandGenerator(_key, stream); }
+
+	//: Next number in [0,1).
+	double Uniform()
+	{
+		if (_left == 0) _Next();
+		return _buf[--_left];
+	}
+
+	//: n numbers in [0,1), the same ones n calls to Uniform() would give.
+	void Fill(double *buf, long n)
+	{
+		while (n > 0 && _left > 0) { *buf++ = _buf[--_left]; n--; }
+		for ( ; n >= 2; n -= 2) {
+			_Next();
+			*buf++ = _buf[1];
+			*buf++ = _buf[0];
+			_left = 0;
+		}
+		if (n > 0) *buf = Uniform();
+	}
+
+	virtual const double HighestRand() const
+	{ return DBL_MAX; }
+	virtual const double LowestRand() const
+	{ return -DBL_MAX; }
+	virtual const double RandGenerationRange() const
+	{ return DBL_MAX; }	
+
+protected:
+	uint64_t _key, _stream, _count;	//key, stream and next block
+	double _buf[2];
+	int _left;								//unused numbers in _buf
+
+	virtual double GetRand(const long double maxVal)
+	{ return maxVal * Uniform(); }
+
+	void _Set(uint64_t key, uint64_t stream)
+	{
+		if (key == 0) {			//splitmix64 of clock and a process-wide count
+			key = ((uint64_t) time(NULL) << 20) ^ (uint64_t) clock();
+			key += (NextRandStream() + 1) * 0x9E3779B97F4A7C15ULL;
+			key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+			key ^= key >> 31;
+			if (key == 0) key = 1;
+		}
+		_key = key;
+		_stream = stream;
+		_count = 0;
+		_left = 0;
+	}
+
+	void _Next()
+	{
+		uint32_t ctr[4] = { (uint32_t) _count, (uint32_t) (_count >> 32),
+								  (uint32_t) _stream, (uint32_t) (_stream >> 32) };
+		uint32_t key[2] = { (uint32_t) _key, (uint32_t) (_key >> 32) };
+		Philox4x32(ctr, key);
+		_count++;
+
+		//top 53 bits of each 64-bit half
+		uint64_t a = ((uint64_t) ctr[1] << 32) | ctr[0];
+		uint64_t b = ((uint64_t) ctr[3] << 32) | ctr[2];
+		_buf[0] = (b >> 11) * (1.0 / 9007199254740992.0);
+		_buf[1] = (a >> 11) * (1.0 / 9007199254740992.0);
+		_left = 2;
+	}
+};
+
+class IntPhiloxRandGenerator : public RandGenerator<int>
+//: Integer RNG on top of PhiloxRandGenerator
+// Unlike IntStdRandGenerator it doesn't go through the global rand(),
+// so every thread can own one.
+{
+public:
+	IntPhiloxRandGenerator(const uint64_t key = 0, const uint64_t stream = 0)
+		: _inner(key, stream) {}
+
+	virtual void Seed(unsigned int seedVal, unsigned int seedVal2)
+	{ _inner.Seed(seedVal, seedVal2); }
+
+	//: Generator for another stream under the same key.
+	IntPhiloxRandGenerator Split(const uint64_t stream) const
+	{ IntPhiloxRandGenerator g; g._inner = _inner.Split(stream); return g; }
+
+	virtual const int HighestRand() const
+	{ return INT_MAX; }
+	virtual const int LowestRand() const
+	{ return -INT_MAX; }
+	virtual const int RandGenerationRange() const
+	{ return INT_MAX; }	
+			
+protected:
+	PhiloxRandGenerator _inner;
+
+	virtual int GetRand(const long double maxVal)
+	{ return static_cast<int>(maxVal * _inner.Uniform()); }
+};
+
 #endif
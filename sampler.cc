@@ -0,0 +1,151 @@
+/* sampler.cc
+
+Repeated non-destructive measurement of a quantum state
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include "sampler.h"
+#include "parallel.h"
+
+QSampler::QSampler(const QState &q, uint64_t seed)
+	: _rng(seed), _streams(1)
+//Vose's construction of the alias table: every slot starts with
+//n*p(i); slots below 1 are topped up from one above 1, which becomes
+//their alias and gives away what it filled in.
+{
+	QIndex i;
+	std::vector<double> p;
+	double total = 0;
+
+	for (i = q.NextNonZero(0); i < q.Outcomes(); i = q.NextNonZero(i + 1)) {
+		_outcome.push_back(i);
+		p.push_back(norm(q.Amp(i)));
+		total += p.back();
+	}
+	assert(!_outcome.empty());
+
+	QIndex n = _outcome.size();
+	std::vector<QIndex> small, large;
+
+	_prob.resize(n);
+	_alias.resize(n);
+	for (i = 0; i < n; i++) {
+		_prob[i] = p[i] * n / total;
+		_alias[i] = i;
+		if (_prob[i] < 1.0)
+			small.push_back(i);
+		else
+			large.push_back(i);
+	}
+
+	while (!small.empty() && !large.empty()) {
+		QIndex s = small.back(), l = large.back();
+		small.pop_back();
+		_alias[s] = l;
+		_prob[l] -= 1.0 - _prob[s];
+		if (_prob[l] < 1.0) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+
+	//whatever is left is 1 up to rounding
+	for (i = 0; i < (QIndex) small.size(); i++) _prob[small[i]] = 1.0;
+	for (i = 0; i < (QIndex) large.size(); i++) _prob[large[i]] = 1.0;
+
+	D("Alias table over %lld outcomes\n", n);
+}
+
+QIndex QSampler::_Draw(PhiloxRandGenerator &g) const
+//returns the position of the outcome in _outcome. One 53-bit number
+//picks the slot and, with its remaining bits, slot or alias.
+{
+	QIndex n = _outcome.size();
+	double u = g.Uniform() * n;
+
+	QIndex i = (QIndex) u;
+	if (i >= n) i = n - 1;
+
+	return (u - i) < _prob[i] ? i : _alias[i];
+}
+
+QIndex QSampler::Sample()
+{
+	return _outcome[_Draw(_rng)];
+}
+
+Histogram QSampler::Sample(long shots)
+{
+	long chunks = (shots + SAMPLE_CHUNK - 1) / SAMPLE_CHUNK;
+	std::vector<Histogram> part(chunks);		//only if !slots
+	uint64_t first = _streams;		//stream 0 is Sample()'s
+	long c;
+
+	_streams += chunks;
+
+	//with fewer outcomes than shots, hits are counted per table slot,
+	//one array per thread (integer sums don't depend on the order);
+	//otherwise each chunk collects its own, sparse, histogram
+	QIndex n = _outcome.size();
+	bool slots = n <= shots;
+	std::vector<long> count(slots ? n : 0);
+
+	#pragma omp parallel if(chunks > 1)
+	{
+		std::vector<long> mine(slots ? n : 0);
+
+		#pragma omp for schedule(dynamic)
+		for (c = 0; c < chunks; c++) {
+			PhiloxRandGenerator g = _rng.Split(first + c);
+			long k = (shots - c * SAMPLE_CHUNK < SAMPLE_CHUNK)
+						? shots - c * SAMPLE_CHUNK : SAMPLE_CHUNK;
+			if (slots)
+				for ( ; k > 0; k--) mine[_Draw(g)]++;
+			else
+				for ( ; k > 0; k--) part[c][_outcome[_Draw(g)]]++;
+		}
+
+		if (slots) {
+			#pragma omp critical
+			for (QIndex i = 0; i < n; i++) count[i] += mine[i];
+		}
+	}
+
+	Histogram h;
+	if (slots) {
+		for (QIndex i = 0; i < n; i++)
+			if (count[i]) h[_outcome[i]] = count[i];
+		return h;
+	}
+
+	for (c = 0; c < chunks; c++)
+		for (Histogram::const_iterator it = part[c].begin();
+			  it != part[c].end(); ++it)
+			h[it->first] += it->second;
+	return h;
+}
+
+Histogram Sample(const QState &q, long shots)
+{
+	QSampler s(q);
+	return s.Sample(shots);
+}
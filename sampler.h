@@ -0,0 +1,92 @@
+/* sampler.h
+
+Repeated non-destructive measurement of a quantum state
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+//! lib="Sampling"
+
+/*
+
+Measure() collapses the state, so collecting statistics used to mean
+rebuilding the state for every shot. A QSampler reads the state once
+and builds a Walker alias table over its nonzero outcomes; after that
+each shot costs one random number and one table lookup, whatever
+the size of the register:
+
+	QSampler s(mystate);
+	Histogram h = s.Sample(100000);	//outcome -> number of hits
+
+or just Sample(mystate, 100000) for a one-off. The state itself is
+not touched.
+
+Shots are drawn in blocks of SAMPLE_CHUNK, each from its own stream of
+the sampler's counter-based generator (see random.h), so the blocks
+can go to different threads and the histogram still only depends on
+the seed, not on the number of threads.
+
+*/
+
+#ifndef _SAMPLER_H_
+#define _SAMPLER_H_
+
+#include <map>
+#include <vector>
+#include "qstate.h"
+#include "random.h"
+
+//: Outcome counts of repeated measurements.
+typedef std::map<QIndex, long> Histogram;
+
+//: Shots drawn from one generator (and by one thread) at a time.
+static const long SAMPLE_CHUNK = 1 << 16;
+
+class QSampler
+//: Alias table for drawing measurement outcomes of a state.
+{
+private:
+	std::vector<QIndex> _outcome;		//: nonzero outcomes
+	std::vector<double> _prob;			//: chance to keep _outcome[i]...
+	std::vector<QIndex> _alias;		//: ...else take _outcome[_alias[i]]
+	PhiloxRandGenerator _rng;			//: key for the per-chunk streams
+	uint64_t _streams;					//: streams used so far
+
+	QIndex _Draw(PhiloxRandGenerator &g) const;
+
+public:
+	//: Build the table for q. [does not disturb state]
+	// seed is the generator key (0 = from the clock).
+	QSampler(const QState &q, uint64_t seed = 0);
+
+	//: Number of outcomes with nonzero probability.
+	QIndex Outcomes() const { return _outcome.size(); }
+
+	//: Draw a single outcome.
+	QIndex Sample();
+
+	//: Draw shots outcomes and count them.
+	Histogram Sample(long shots);
+};
+
+//: Measure shots copies of q without collapsing it.
+Histogram Sample(const QState &q, long shots);
+
+#endif
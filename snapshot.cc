@@ -0,0 +1,281 @@
+/* snapshot.cc
+
+Binary checkpoints of a quantum state
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include <string.h>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "qstate.h"
+
+static const char SNAP_MAGIC[8] = { 'O','Q','S','T','A','T','E','\032' };
+
+static uint64_t HashBytes(const unsigned char *p, size_t n, uint64_t h)
+//multiply-rotate over 64-bit words, finished with an avalanche
+{
+	static const uint64_t P1 = 0x9E3779B185EBCA87ULL;
+	static const uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+	uint64_t w;
+
+	for ( ; n >= 8; n -= 8, p += 8) {
+		memcpy(&w, p, 8);
+		h ^= w * P2;
+		h = ((h << 31) | (h >> 33)) * P1;
+	}
+	for ( ; n; n--, p++) {
+		h ^= *p * P2;
+		h = ((h << 31) | (h >> 33)) * P1;
+	}
+
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	return h;
+}
+
+uint64_t SnapChecksum(const void *data, size_t bytes)
+{
+	const unsigned char *p = (const unsigned char *) data;
+	long blocks = (bytes + SNAP_BLOCK - 1) / SNAP_BLOCK, b;
+	std::vector<uint64_t> h(blocks);
+
+	#pragma omp parallel for schedule(static) if(blocks > 1)
+	for (b = 0; b < blocks; b++) {
+		size_t n = (b == blocks - 1) ? bytes - b * SNAP_BLOCK : SNAP_BLOCK;
+		h[b] = HashBytes(p + b * SNAP_BLOCK, n, b);
+	}
+
+	return HashBytes((const unsigned char *) &h[0], blocks * sizeof(uint64_t),
+						  bytes);
+}
+
+QSnapshot::QSnapshot(const char *filename, bool verify)
+	: _map(NULL), _size(0), _head(NULL), _error(NULL)
+{
+	if (!_Open(filename, verify)) _head = NULL;
+}
+
+QSnapshot::~QSnapshot()
+{
+	if (_map) munmap((void *) _map, _size);
+}
+
+bool QSnapshot::_Open(const char *filename, bool verify)
+{
+	struct stat st;
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0) { _error = "cannot open file"; return false; }
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(SnapHeader)) {
+		close(fd);
+		_error = "not a snapshot";
+		return false;
+	}
+
+	_size = st.st_size;
+	void *m = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) { _error = "cannot map file"; return false; }
+	_map = (const char *) m;
+	madvise(m, _size, MADV_SEQUENTIAL);
+
+	_head = (const SnapHeader *) _map;
+	if (memcmp(_head->magic, SNAP_MAGIC, 8)) {
+		_error = "not a snapshot";
+		return false;
+	}
+	if (_head->version != SNAP_VERSION) {
+		_error = "unsupported snapshot version or byte order";
+		return false;
+	}
+	if ((_head->real != sizeof(float) && _head->real != sizeof(double))
+		 || _head->qubits < 1 || _head->qubits > 62
+		 || (_head->flags & ~SNAP_SPARSE)) {
+		_error = "corrupt snapshot header";
+		return false;
+	}
+
+	QIndex states = (QIndex) 1 << _head->qubits;
+	if (IsSparse() ? _head->count > (uint64_t) states : _head->count != (uint64_t) states) {
+		_error = "corrupt snapshot header";
+		return false;
+	}
+
+	//count is checked by division first: with 60 qubits or more the
+	//payload size would overflow size_t
+	size_t each = 2 * _head->real + (IsSparse() ? sizeof(int64_t) : 0);
+	if (_head->count > (_size - sizeof(SnapHeader)) / each
+		 || _size != sizeof(SnapHeader) + _head->count * each) {
+		_error = "snapshot truncated";
+		return false;
+	}
+
+	if (verify && SnapChecksum(_map + sizeof(SnapHeader), _head->count * each)
+						!= _head->checksum) {
+		_error = "checksum mismatch";
+		return false;
+	}
+
+	//QState relies on sparse outcomes being ascending and in range
+	if (IsSparse()) {
+		const int64_t *o = Outcomes();
+		for (QIndex i = 0; i < Count(); i++)
+			if (o[i] < 0 || o[i] >= states || (i && o[i] <= o[i-1])) {
+				_error = "corrupt outcome list";
+				return false;
+			}
+	}
+
+	return true;
+}
+
+const Complex *QSnapshot::Amps() const
+{
+	if (_head->real != sizeof(QReal)) return NULL;
+	return (const Complex *) ((const char *) Outcomes()
+									  + (IsSparse() ? Count() * sizeof(int64_t) : 0));
+}
+
+const int64_t *QSnapshot::Outcomes() const
+{
+	return (const int64_t *) (_map + sizeof(SnapHeader));
+}
+
+Complex QSnapshot::Amp(QIndex i) const
+{
+	const char *a = (const char *) Outcomes()
+						 + (IsSparse() ? Count() * sizeof(int64_t) : 0);
+
+	if (_head->real == sizeof(double)) {
+		double c[2];
+		memcpy(c, a + i * sizeof(c), sizeof(c));
+		return Complex(c[0], c[1]);
+	}
+
+	float c[2];
+	memcpy(c, a + i * sizeof(c), sizeof(c));
+	return Complex(c[0], c[1]);
+}
+
+bool QState::Save(const char *filename) const
+//writes to filename.tmp, syncs it and renames it, so a crash while
+//writing leaves the previous checkpoint intact
+{
+	SnapHeader h;
+	std::vector<char> list;					//sparse payload
+	const char *data;
+	size_t bytes;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SNAP_MAGIC, 8);
+	h.version = SNAP_VERSION;
+	h.flags = _sparse ? SNAP_SPARSE : 0;
+	h.qubits = _nQubits;
+	h.real = sizeof(QReal);
+
+	if (_sparse) {
+		h.count = _sArray.size();
+		list.resize(h.count * (sizeof(int64_t) + sizeof(Complex)));
+
+		int64_t *o = (int64_t *) &list[0];
+		Complex *a = (Complex *) (o + h.count);
+		for (SparseArray::const_iterator it = _sArray.begin();
+			  it != _sArray.end(); ++it) {
+			*o++ = it->first;
+			*a++ = it->second;
+		}
+		data = list.empty() ? NULL : &list[0];
+		bytes = list.size();
+	} else {
+		h.count = _nStates;
+		data = (const char *) &_qArray[0];
+		bytes = _nStates * sizeof(Complex);
+	}
+	h.checksum = SnapChecksum(data, bytes);
+
+	std::string tmp = std::string(filename) + ".tmp";
+	FILE *FH = fopen(tmp.c_str(), "wb");
+	if (FH == NULL) {
+		cerr << "ERROR: could not open file " << tmp << endl;
+		return false;
+	}
+
+	bool ok = fwrite(&h, sizeof(h), 1, FH) == 1
+				 && (bytes == 0 || fwrite(data, bytes, 1, FH) == 1);
+	ok = ok && fflush(FH) == 0 && fsync(fileno(FH)) == 0;
+	ok = (fclose(FH) == 0) && ok;
+
+	if (!ok || rename(tmp.c_str(), filename) != 0) {
+		cerr << "ERROR: could not write snapshot " << filename << endl;
+		unlink(tmp.c_str());
+		return false;
+	}
+
+	D("Saved %llu amplitudes to %s\n", (unsigned long long) h.count, filename);
+	return true;
+}
+
+bool QState::Load(const char *filename)
+{
+	QSnapshot s(filename);
+	QIndex i, n = s ? s.Count() : 0;
+
+	if (!s) {
+		cerr << "ERROR: " << filename << ": " << s.Error() << endl;
+		return false;
+	}
+
+	_nQubits = s.Qubits();
+	_nStates = (QIndex) 1 << _nQubits;
+	_sArray.clear();
+	if (!(_qArray.IsShared() && !s.IsSparse() && n == _qArray.size()))
+		_qArray.release();					//don't hold both copies
+
+	if (s.IsSparse()) {
+		const int64_t *o = s.Outcomes();
+		for (i = 0; i < n; i++)
+			_sArray.insert(_sArray.end(), SparseArray::value_type(o[i], s.Amp(i)));
+		_sparse = true;
+	} else {
+		const Complex *a = s.Amps();
+		_qArray.resize(_nStates);
+
+		#pragma omp parallel for schedule(static) if(n > PAR_CHUNK)
+		for (i = 0; i < n; i += PAR_CHUNK) {
+			QIndex j, end = (i + PAR_CHUNK < n) ? i + PAR_CHUNK : n;
+			if (a)
+				memcpy(&_qArray[i], a + i, (end - i) * sizeof(Complex));
+			else
+				for (j = i; j < end; j++) _qArray[j] = s.Amp(j);
+		}
+		_sparse = false;
+	}
+
+	D("Loaded %lld amplitudes from %s\n", n, filename);
+	Compact();
+	return true;
+}
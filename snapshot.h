@@ -0,0 +1,143 @@
+/* snapshot.h
+
+Binary checkpoints of a quantum state
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+//! lib="Snapshots"
+
+/*
+
+Dump() writes one line of text per amplitude, which for a 30 qubit
+register is tens of gigabytes and takes minutes to write and parse.
+QState::Save() writes the amplitudes as they are in memory instead,
+behind a 64 byte header:
+
+	magic		"OQSTATE" and a ^Z
+	version	SNAP_VERSION
+	flags		SNAP_SPARSE if the state was sparse
+	qubits	register size
+	real		bytes per real number (4 = Q_SINGLE, 8 = double)
+	count		amplitudes stored (2^qubits when dense)
+	checksum	SnapChecksum() of everything after the header
+
+A dense payload is the amplitude array, (re,im) pairs in outcome
+order. A sparse one is count 64-bit outcomes followed by their count
+amplitudes. Numbers are in the byte order of the machine that wrote
+them; a file from the other byte order fails the version check.
+
+QSnapshot maps such a file read-only, so the amplitudes can be
+inspected in place without reading the file first:
+
+	QSnapshot s("shor.qs");
+	if (s) printf("%d qubits\n", s.Qubits());
+
+QState::Load() restores a state from one; the pages are copied straight
+into the amplitude array (or converted, if the file was written in the
+other precision), with no parsing.
+
+*/
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "complex.h"
+#include "utility.h"
+
+//: Current snapshot format version.
+static const uint32_t SNAP_VERSION = 1;
+
+//: Header flag: payload is (outcome, amplitude) lists.
+static const uint32_t SNAP_SPARSE = 1;
+
+//: Bytes hashed as one independent block by SnapChecksum().
+static const size_t SNAP_BLOCK = 1 << 20;
+
+//: File header of a snapshot.
+struct SnapHeader {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	flags;
+	uint32_t	qubits;
+	uint32_t	real;
+	uint64_t	count;
+	uint64_t	checksum;
+	uint64_t	reserved[3];					//zero
+};
+
+//: Checksum of a snapshot payload.
+// Blocks of SNAP_BLOCK bytes are hashed in parallel and the block
+// hashes combined in order, so the value does not depend on threads.
+uint64_t SnapChecksum(const void *data, size_t bytes);
+
+class QSnapshot
+//: Read-only memory mapping of a snapshot file.
+{
+private:
+	const char *_map;						//: whole file, or NULL
+	size_t _size;							//: bytes mapped
+	const SnapHeader *_head;
+	const char *_error;					//: why the file was rejected
+
+	bool _Open(const char *filename, bool verify);
+
+	QSnapshot(const QSnapshot&);				//not copyable
+	QSnapshot& operator= (const QSnapshot&);
+
+public:
+	//: Map filename and check its header (and checksum if verify).
+	QSnapshot(const char *filename, bool verify = true);
+
+	//: Unmap the file.
+	~QSnapshot();
+
+	//: True if the file is a valid snapshot.
+	operator bool() const { return _head != NULL; }
+
+	//: Reason the file was rejected. (NULL if it wasn't)
+	const char *Error() const { return _error; }
+
+	//: Register size.
+	int Qubits() const { return _head->qubits; }
+
+	//: True if the payload is a sparse list.
+	bool IsSparse() const { return _head->flags & SNAP_SPARSE; }
+
+	//: Number of stored amplitudes.
+	QIndex Count() const { return _head->count; }
+
+	//: Bytes per real number in the file.
+	int RealSize() const { return _head->real; }
+
+	//: Amplitudes in place, if the file has this build's precision.
+	// (NULL otherwise; use Amp() then)
+	const Complex *Amps() const;
+
+	//: Outcomes of a sparse payload, in place.
+	const int64_t *Outcomes() const;
+
+	//: The i-th stored amplitude, in either precision.
+	Complex Amp(QIndex i) const;
+};
+
+#endif
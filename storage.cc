@@ -0,0 +1,569 @@
+/* storage.cc
+
+Dense amplitude storage, on the heap or in shared memory
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <new>
+#include <algorithm>
+#include "storage.h"
+#include "parallel.h"
+#include "debug.h"
+
+static const char SHM_MAGIC[8] = { 'O','Q','S','H','A','R','E','\0' };
+static const uint32_t SHM_VERSION = 2;
+
+//readers that can be in Acquire()/Release() at once
+static const int SHM_READERS = 64;
+
+//how often Publish() looks for readers that died (nanoseconds)
+static const long SHM_POLL = 100000000;
+
+struct ShmReader {
+	pid_t		pid;							//0 for a free slot
+	int		reading;						//between Acquire/Release
+};
+
+struct AmpArray::Head {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	qubits;
+	uint32_t	real;							//bytes per real number
+	uint32_t	unused;
+	uint64_t	count;						//amplitudes after the header
+	uint64_t	generation;					//Publish() calls
+	int		writing;						//writer is running gates
+	int		waiting;						//readers in Acquire()
+	int		readers;						//readers between Acquire/Release
+	ShmReader reader[SHM_READERS];		//who they are
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+};
+
+static int OpenSegment(const char *name, int flags)
+//a name with a '/' is a file, anything else a POSIX shm object
+{
+	if (strchr(name, '/')) return open(name, flags, 0644);
+	return shm_open((std::string("/") + name).c_str(), flags, 0644);
+}
+
+static void Lock(pthread_mutex_t *m)
+//the lock is robust: if a reader died holding it, take it over
+{
+	if (pthread_mutex_lock(m) == EOWNERDEAD)
+		pthread_mutex_consistent(m);
+}
+
+static void Wait(pthread_cond_t *c, pthread_mutex_t *m)
+{
+	if (pthread_cond_wait(c, m) == EOWNERDEAD)
+		pthread_mutex_consistent(m);
+}
+
+static bool WaitFor(pthread_cond_t *c, pthread_mutex_t *m, long ns)
+//false if ns passed without a signal
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	t.tv_nsec += ns;
+	t.tv_sec += t.tv_nsec / 1000000000;
+	t.tv_nsec %= 1000000000;
+
+	int e = pthread_cond_timedwait(c, m, &t);
+	if (e == EOWNERDEAD) pthread_mutex_consistent(m);
+	return e != ETIMEDOUT;
+}
+
+static bool Alive(pid_t pid)
+//a process that has exited but was not waited for yet is gone too
+{
+	if (kill(pid, 0) < 0 && errno == ESRCH) return false;
+
+	char buf[256], *p;
+	snprintf(buf, sizeof(buf), "/proc/%d/stat", (int) pid);
+	FILE *f = fopen(buf, "r");
+	if (f == NULL) return true;
+	p = fgets(buf, sizeof(buf), f);
+	fclose(f);
+
+	//pid (command) state ..., and the command may hold anything
+	if (p == NULL || (p = strrchr(buf, ')')) == NULL) return true;
+	return p[1] != ' ' || (p[2] != 'Z' && p[2] != 'X');
+}
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED	1
+#define MPOL_INTERLEAVE	3
+#endif
+
+static PagePolicy pagePolicy = PAGES_HUGE;
+static NumaPolicy numaPolicy = NUMA_FIRST_TOUCH;
+
+void SetAllocPolicy(PagePolicy pages, NumaPolicy numa)
+{
+	pagePolicy = pages;
+	numaPolicy = numa;
+}
+
+PagePolicy GetPagePolicy()
+{
+	return pagePolicy;
+}
+
+NumaPolicy GetNumaPolicy()
+{
+	return numaPolicy;
+}
+
+int NumaNodes()
+{
+	static int nodes = 0;
+	char path[64];
+	struct stat st;
+	int n;
+
+	if (nodes) return nodes;
+	for (n = 0; n < 63; n++) {					//one bit each in a node mask
+		sprintf(path, "/sys/devices/system/node/node%d", n);
+		if (stat(path, &st) != 0) break;
+	}
+	nodes = n ? n : 1;
+	return nodes;
+}
+
+static void Place(char *p, size_t len, size_t page)
+//bind fresh pages to nodes as the NUMA policy says; must come before
+//they are touched. page is the granularity slices are cut at.
+{
+#ifdef SYS_mbind
+	int nodes = NumaNodes();
+	unsigned long mask;
+
+	if (numaPolicy == NUMA_INTERLEAVE) {
+		mask = (1UL << nodes) - 1;
+		if (syscall(SYS_mbind, p, len, MPOL_INTERLEAVE, &mask, sizeof(mask) * 8, 0))
+			D("mbind(MPOL_INTERLEAVE) failed\n");
+	} else if (numaPolicy == NUMA_PARTITION) {
+		size_t slice = (len / nodes + page - 1) / page * page;
+		for (int k = 0; k < nodes && k * slice < len; k++) {
+			size_t l = (len - k * slice < slice) ? len - k * slice : slice;
+			mask = 1UL << k;
+			if (syscall(SYS_mbind, p + k * slice, l, MPOL_PREFERRED, &mask,
+							sizeof(mask) * 8, 0))
+				D("mbind(MPOL_PREFERRED, node %d) failed\n", k);
+		}
+	}
+#endif
+}
+
+static void *MapPages(size_t bytes, size_t &len)
+//anonymous mapping with the page and NUMA policy; len is its length
+{
+	char *p = (char *) MAP_FAILED;
+	size_t page = 4096;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+	if (pagePolicy == PAGES_2M || pagePolicy == PAGES_1G) {
+		int shift = (pagePolicy == PAGES_2M) ? 21 : 30;
+		page = (size_t) 1 << shift;
+		len = (bytes + page - 1) & ~(page - 1);
+		p = (char *) mmap(NULL, len, PROT_READ | PROT_WRITE,
+								flags | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0);
+		if (p == MAP_FAILED) {
+			D("No %s pages reserved, using transparent huge pages\n",
+			  shift == 21 ? "2MB" : "1GB");
+			page = 4096;
+		}
+	}
+#endif
+
+	if (p == MAP_FAILED) {
+		len = (bytes + page - 1) & ~(page - 1);
+		p = (char *) mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (p == MAP_FAILED) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+		if (pagePolicy != PAGES_NORMAL) {
+			madvise(p, len, MADV_HUGEPAGE);
+			page = 1 << 21;						//don't split a huge page
+		}
+#endif
+	}
+
+	Place(p, len, page);
+	return p;
+}
+
+static Complex *Allocate(QIndex n, size_t &mapped)
+//n amplitudes; from the heap and zero if small, else mapped and not
+//yet touched
+{
+	mapped = 0;
+	if (n == 0) return NULL;
+	if (n * sizeof(Complex) < MAP_MIN) return new Complex[n];
+	return (Complex *) MapPages(n * sizeof(Complex), mapped);
+}
+
+static void Free(Complex *a, size_t mapped)
+{
+	if (mapped) munmap(a, mapped);
+	else delete[] a;
+}
+
+static void Copy(Complex *to, const Complex *from, QIndex n)
+{
+	QIndex i;
+	#pragma omp parallel for schedule(static) if(n > PAR_CHUNK)
+	for (i = 0; i < n; i += PAR_CHUNK)
+		memcpy(to + i, from + i, (n - i < PAR_CHUNK ? n - i : PAR_CHUNK)
+										 * sizeof(Complex));
+}
+
+static void Zero(Complex *a, QIndex n)
+//the first touch of a mapped array: every thread gets the contiguous
+//share a static schedule over PAR_CHUNK pieces gives it in the gate
+//kernels too
+{
+	QIndex i;
+	#pragma omp parallel for schedule(static) if(n > PAR_CHUNK)
+	for (i = 0; i < n; i += PAR_CHUNK)
+		std::fill(a + i, a + (n - i < PAR_CHUNK ? n : i + PAR_CHUNK), Complex(0));
+}
+
+AmpArray::AmpArray(QIndex n)
+	: _n(n), _kind(HEAP), _head(NULL)
+{
+	_a = Allocate(n, _mapped);
+	if (_mapped) Zero(_a, n);
+}
+
+AmpArray::AmpArray(const AmpArray &b)
+	: _n(b._n), _kind(HEAP), _head(NULL)
+{
+	_a = Allocate(_n, _mapped);
+	Copy(_a, b._a, _n);
+}
+
+AmpArray& AmpArray::operator= (const AmpArray &b)
+{
+	if (this != &b) {
+		AmpArray t(b);
+		release();
+		_a = t._a; _n = t._n; _mapped = t._mapped;
+		t._a = NULL; t._n = 0; t._mapped = 0;
+	}
+	return *this;
+}
+
+AmpArray::~AmpArray()
+{
+	release();
+}
+
+void AmpArray::_Unmap()
+{
+	if (_kind == SHARED) {
+		//readers must not wait for a writer that is gone
+		Lock(&_head->lock);
+		_head->writing = 0;
+		pthread_cond_broadcast(&_head->changed);
+		pthread_mutex_unlock(&_head->lock);
+		munmap(_head, SHM_HEADER + _n * sizeof(Complex));
+	} else if (_kind == VIEW) {
+		munmap(_head, SHM_HEADER);
+		munmap(_a, _n * sizeof(Complex));
+	}
+	_head = NULL;
+	_kind = HEAP;
+}
+
+void AmpArray::release()
+{
+	if (_kind == HEAP) Free(_a, _mapped);
+	else _Unmap();
+	_a = NULL;
+	_n = 0;
+	_mapped = 0;
+}
+
+void AmpArray::resize(QIndex n)
+{
+	if (n == _n) return;
+
+	size_t mapped;
+	QIndex keep = n < _n ? n : _n;
+	Complex *a = Allocate(n, mapped);
+
+	Copy(a, _a, keep);
+	if (mapped) Zero(a + keep, n - keep);
+	release();
+	_a = a;
+	_n = n;
+	_mapped = mapped;
+}
+
+void AmpArray::assign(QIndex n, const Complex &v)
+{
+	QIndex i;
+
+	if (n != _n) {
+		release();
+		_a = Allocate(n, _mapped);
+		_n = n;
+	}
+
+	#pragma omp parallel for schedule(static) if(n > PAR_CHUNK)
+	for (i = 0; i < n; i++) _a[i] = v;
+}
+
+bool AmpArray::Share(const char *name, int qubits)
+{
+	size_t bytes = SHM_HEADER + _n * sizeof(Complex);
+
+	//a segment of that name may still be mapped by readers; resizing
+	//it would fault them, so it is unlinked (they keep the old one)
+	//and a fresh one created
+	RemoveShared(name);
+	int fd = OpenSegment(name, O_RDWR | O_CREAT | O_EXCL);
+
+	if (fd < 0) return false;
+	if (ftruncate(fd, bytes) < 0) { close(fd); return false; }
+	void *m = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) return false;
+
+	Head *h = (Head *) m;
+	h->version = SHM_VERSION;
+	h->qubits = qubits;
+	h->real = sizeof(QReal);
+	h->count = _n;
+	h->generation = 0;
+	h->writing = 1;
+	h->waiting = h->readers = 0;
+	memset(h->reader, 0, sizeof(h->reader));
+
+	pthread_mutexattr_t ma;
+	pthread_mutexattr_init(&ma);
+	pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&h->lock, &ma);
+	pthread_mutexattr_destroy(&ma);
+
+	pthread_condattr_t ca;
+	pthread_condattr_init(&ca);
+	pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED);
+	pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+	pthread_cond_init(&h->changed, &ca);
+	pthread_condattr_destroy(&ca);
+
+	//readers check the magic, so it goes in last
+	__sync_synchronize();
+	memcpy(h->magic, SHM_MAGIC, 8);
+
+	Complex *a = (Complex *) ((char *) m + SHM_HEADER);
+	QIndex n = _n;
+	Copy(a, _a, n);
+	release();
+
+	_a = a;
+	_n = n;
+	_kind = SHARED;
+	_head = h;
+	return true;
+}
+
+int AmpArray::Attach(const char *name)
+{
+	struct stat st;
+	int fd = OpenSegment(name, O_RDWR);
+
+	if (fd < 0) return 0;
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < SHM_HEADER) {
+		close(fd);
+		return 0;
+	}
+
+	//the header (and its locks) shared, the amplitudes copy-on-write
+	Head *h = (Head *) mmap(NULL, SHM_HEADER, PROT_READ | PROT_WRITE,
+									MAP_SHARED, fd, 0);
+	if ((void *) h == MAP_FAILED) { close(fd); return 0; }
+
+	if (memcmp(h->magic, SHM_MAGIC, 8) || h->version != SHM_VERSION
+		 || h->real != sizeof(QReal)
+		 || (size_t) st.st_size != SHM_HEADER + h->count * sizeof(Complex)) {
+		munmap(h, SHM_HEADER);
+		close(fd);
+		return 0;
+	}
+
+	void *a = mmap(NULL, h->count * sizeof(Complex), PROT_READ | PROT_WRITE,
+						MAP_PRIVATE, fd, SHM_HEADER);
+	close(fd);
+	if (a == MAP_FAILED) { munmap(h, SHM_HEADER); return 0; }
+
+	release();
+	_a = (Complex *) a;
+	_n = h->count;
+	_kind = VIEW;
+	_head = h;
+	return h->qubits;
+}
+
+void AmpArray::Publish()
+{
+	if (_kind != SHARED) return;
+
+	Lock(&_head->lock);
+	_head->writing = 0;
+	_head->generation++;
+	pthread_cond_broadcast(&_head->changed);
+
+	//a reader that died between Acquire() and Release() never signals;
+	//while waiting, drop the slots of processes that are gone
+	while (_head->waiting > 0 || _head->readers > 0)
+		if (!WaitFor(&_head->changed, &_head->lock, SHM_POLL))
+			for (int i = 0; i < SHM_READERS; i++) {
+				ShmReader &r = _head->reader[i];
+				if (r.pid == 0 || Alive(r.pid)) continue;
+				if (r.reading) _head->readers--;
+				else _head->waiting--;
+				r.pid = 0;
+			}
+	_head->writing = 1;
+	pthread_mutex_unlock(&_head->lock);
+}
+
+uint64_t AmpArray::Acquire()
+{
+	if (_kind != VIEW) return 0;
+
+	pid_t pid = getpid();
+	int i;
+
+	Lock(&_head->lock);
+	for (;;) {
+		for (i = 0; i < SHM_READERS && _head->reader[i].pid; i++) ;
+		if (i < SHM_READERS) break;
+		Wait(&_head->changed, &_head->lock);		//all slots taken
+	}
+	ShmReader &r = _head->reader[i];
+	r.pid = pid;
+	r.reading = 0;
+	_head->waiting++;
+	while (_head->writing)
+		Wait(&_head->changed, &_head->lock);
+	_head->waiting--;
+	_head->readers++;
+	r.reading = 1;
+	uint64_t g = _head->generation;
+	pthread_mutex_unlock(&_head->lock);
+	return g;
+}
+
+void AmpArray::Release()
+{
+	if (_kind != VIEW) return;
+
+	pid_t pid = getpid();
+
+	Lock(&_head->lock);
+	for (int i = 0; i < SHM_READERS; i++) {
+		ShmReader &r = _head->reader[i];
+		if (r.pid == pid && r.reading) {
+			r.pid = 0;
+			_head->readers--;
+			break;
+		}
+	}
+	pthread_cond_broadcast(&_head->changed);
+	pthread_mutex_unlock(&_head->lock);
+}
+
+bool RemoveShared(const char *name)
+{
+	if (strchr(name, '/')) return unlink(name) == 0;
+	return shm_unlink((std::string("/") + name).c_str()) == 0;
+}
+
+//handed out pieces start on cache lines, so threads working on
+//neighbouring ones don't share a line
+static const size_t WS_ALIGN = 64;
+
+Workspace::~Workspace()
+{
+	assert(_depth == 0);
+	if (_mapped) munmap(_base, _mapped);
+	else delete[] _base;
+}
+
+void *Workspace::_Take(size_t bytes)
+{
+	bytes = (bytes + WS_ALIGN - 1) & ~(WS_ALIGN - 1);
+	size_t at = (_used + WS_ALIGN - 1) & ~(WS_ALIGN - 1);
+	char *base = (char *) (((uintptr_t) _base + WS_ALIGN - 1) & ~(WS_ALIGN - 1));
+
+	_used = at + bytes;
+	if (_used > _need) _need = _used;
+	if (_base && base + _used <= _base + _size)
+		return base + at;
+
+	//doesn't fit this time; the frames after the last close will
+	char *p = new char[bytes + WS_ALIGN];
+	_extra.push_back(p);
+	return (char *) (((uintptr_t) p + WS_ALIGN - 1) & ~(WS_ALIGN - 1));
+}
+
+void Workspace::_Close(size_t mark)
+{
+	assert(_depth > 0);
+	_used = mark;
+	if (--_depth > 0 || _extra.empty()) return;
+
+	for (size_t i = 0; i < _extra.size(); i++)
+		delete[] _extra[i];
+	_extra.clear();
+
+	D("Workspace grows from %lu to %lu bytes\n", (unsigned long) _size,
+	  (unsigned long) _need);
+	if (_mapped) munmap(_base, _mapped);
+	else delete[] _base;
+
+	_size = _need + WS_ALIGN;
+	_mapped = 0;
+	if (_size >= MAP_MIN)
+		_base = (char *) MapPages(_size, _mapped);
+	else
+		_base = new char[_size];
+}
@@ -0,0 +1,246 @@
+/* storage.h
+
+Dense amplitude storage, on the heap or in shared memory
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+//! lib="Quantum State [OpenQubit Core]"
+
+/*
+
+A QState keeps its dense amplitudes in an AmpArray. Normally that is
+a plain heap array, but a simulator can move it into a named segment
+so other processes can look at the register while it runs, without a
+copy of their own:
+
+	//simulator
+	QState q(30);
+	q.Share("shor");				//POSIX shm; a name with a '/' is a file
+	for (...) {
+		...gates...
+		q.Publish();				//let waiting readers look
+	}
+
+	//analysis process
+	QState view(1);
+	view.Attach("shor");			//takes the size of the shared state
+	view.Acquire();				//wait for the next Publish()
+	Histogram h = Sample(view, 100000);
+	view.Release();				//let the simulator go on
+
+The segment is one page of header followed by the amplitudes. The
+simulator maps it shared and runs its gates on it in place; readers
+map it copy-on-write, so they see the simulator's amplitudes but
+anything they change themselves (e.g. by measuring) stays private;
+pages a reader has changed no longer follow the simulator until it
+attaches again.
+
+Between Share() and Publish() the simulator is writing. Acquire()
+waits until it is not, and Publish() lets everyone who is waiting in
+and returns once all of them have called Release() or exited (each
+reader holds one of 64 slots; Publish() checks every 100ms whether the
+processes in them are still alive). A shared state is
+kept dense; converting it to sparse storage or loading a snapshot of
+a different size ends the sharing (the segment stays, with the last amplitudes,
+until RemoveShared()).
+
+Arrays of MAP_MIN bytes or more are mapped directly rather than taken
+from the heap, following a process-wide policy set before the states
+are made:
+
+	SetAllocPolicy(PAGES_2M, NUMA_PARTITION);
+	QState q(32);
+
+PAGES_HUGE asks the kernel for transparent huge pages; PAGES_2M and
+PAGES_1G map explicitly reserved ones (/proc/sys/vm/nr_hugepages or
+the hugepagesz= boot options) and fall back to PAGES_HUGE if there
+are none. On a NUMA machine NUMA_INTERLEAVE spreads the pages over all
+nodes round robin, NUMA_PARTITION gives node k the k-th slice of the
+array, and NUMA_FIRST_TOUCH leaves each page on the node of the thread
+that first writes it. A new array is always first written by all
+threads, each zeroing the same contiguous share a gate kernel later
+hands it, so with threads bound to cores (OMP_PROC_BIND=close) the
+first-touch and partitioned layouts both keep every thread's share on
+its own node.
+
+*/
+
+#ifndef _STORAGE_H_
+#define _STORAGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "complex.h"
+#include "utility.h"
+
+//: Bytes in front of the amplitudes of a shared segment.
+static const size_t SHM_HEADER = 4096;
+
+//: Arrays at least this big (in bytes) are mapped with the policy below.
+static const size_t MAP_MIN = 1 << 21;
+
+//: Page size for large arrays.
+enum PagePolicy { PAGES_NORMAL, PAGES_HUGE, PAGES_2M, PAGES_1G };
+
+//: Placement of their pages on the nodes of a NUMA machine.
+enum NumaPolicy { NUMA_FIRST_TOUCH, NUMA_INTERLEAVE, NUMA_PARTITION };
+
+//: Policy for arrays allocated from now on.
+// (default PAGES_HUGE, NUMA_FIRST_TOUCH)
+void SetAllocPolicy(PagePolicy pages, NumaPolicy numa = NUMA_FIRST_TOUCH);
+
+//: Page size policy in effect.
+PagePolicy GetPagePolicy();
+
+//: NUMA policy in effect.
+NumaPolicy GetNumaPolicy();
+
+//: Number of NUMA nodes. (1 on a machine without NUMA)
+int NumaNodes();
+
+class AmpArray
+//: Array of 2^n amplitudes, on the heap or in a mapped segment.
+{
+private:
+	struct Head;							//: segment header
+	enum Kind { HEAP, SHARED, VIEW };
+
+	Complex *_a;
+	QIndex _n;
+	Kind _kind;
+	size_t _mapped;						//: HEAP: bytes mapped, 0 if from new[]
+	Head *_head;							//: SHARED and VIEW only
+
+	void _Unmap();
+
+public:
+	AmpArray() : _a(NULL), _n(0), _kind(HEAP), _mapped(0), _head(NULL) {}
+	AmpArray(QIndex n);
+	AmpArray(const AmpArray &b);		//copies are always on the heap
+	AmpArray& operator= (const AmpArray &b);
+	~AmpArray();
+
+	QIndex size() const { return _n; }
+
+	Complex& operator[] (QIndex i) { return _a[i]; }
+	const Complex& operator[] (QIndex i) const { return _a[i]; }
+
+	//: Change the size, keeping the first amplitudes; new ones are 0.
+	void resize(QIndex n);
+
+	//: n copies of v.
+	void assign(QIndex n, const Complex &v);
+
+	//: Free the storage (or stop sharing it).
+	void release();
+
+	//: Move the amplitudes into a new segment name.
+	bool Share(const char *name, int qubits);
+
+	//: Map the segment name copy-on-write. (returns its qubits, or 0)
+	int Attach(const char *name);
+
+	//: True if the amplitudes live in a segment.
+	bool IsShared() const { return _kind != HEAP; }
+
+	//: Writer: let waiting readers in and wait until they are done.
+	void Publish();
+
+	//: Reader: wait until the writer is between gates. (returns the
+	// number of Publish() calls so far)
+	uint64_t Acquire();
+
+	//: Reader: done looking.
+	void Release();
+};
+
+//: Delete a segment made by QState::Share().
+bool RemoveShared(const char *name);
+
+/*
+
+Measurements and some gates need temporaries: partial sums per chunk,
+probability tables, the partner's half of a distributed register.
+Rather than allocating them on every call, a state keeps a Workspace
+and takes them from a Workspace::Frame, which gives the memory back
+when it goes out of scope:
+
+	Workspace::Frame f(_scratch);
+	QAccum *part = f.Get<QAccum>(chunks);		//not initialized
+
+Frames nest (a measurement that calls _Pick() opens two). When an
+operation needs more than the workspace holds, the rest comes from
+the heap for this once and the workspace grows to the whole amount
+when the outermost frame closes, so from the second call on nothing is
+allocated. The memory is kept until the owner goes away; above MAP_MIN
+it is mapped with the same policy as the amplitudes.
+
+*/
+
+class Workspace
+//: Reusable scratch memory for the temporaries of one operation.
+{
+private:
+	char *_base;
+	size_t _size;							//: bytes at _base
+	size_t _mapped;						//: bytes mapped, 0 if from new[]
+	size_t _used;							//: bytes handed out by open frames
+	size_t _need;							//: most bytes wanted at once
+	int _depth;								//: open frames
+	std::vector<char *> _extra;		//: overflow, freed with the last frame
+
+	size_t _Open() { _depth++; return _used; }
+	void _Close(size_t mark);
+	void *_Take(size_t bytes);
+
+public:
+	Workspace() : _base(NULL), _size(0), _mapped(0), _used(0), _need(0),
+					  _depth(0) {}
+	Workspace(const Workspace &) : _base(NULL), _size(0), _mapped(0), _used(0),
+											 _need(0), _depth(0) {}	//copies start empty
+	Workspace& operator= (const Workspace &) { return *this; }
+	~Workspace();
+
+	//: Bytes kept for reuse.
+	size_t Capacity() const { return _size; }
+
+	class Frame
+	//: Scratch memory from a Workspace, returned at the end of the scope.
+	{
+	private:
+		Workspace &_w;
+		size_t _mark;
+
+		Frame(const Frame &);
+		Frame& operator= (const Frame &);
+
+	public:
+		Frame(Workspace &w) : _w(w), _mark(w._Open()) {}
+		~Frame() { _w._Close(_mark); }
+
+		//: Room for n objects of type T. (not initialized)
+		template <class T>
+		T *Get(size_t n) { return (T *) _w._Take(n * sizeof(T)); }
+	};
+};
+
+#endif
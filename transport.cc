@@ -0,0 +1,288 @@
+/* transport.cc
+
+Communication between the processes of a distributed state
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include "transport.h"
+#include "parallel.h"
+#ifdef Q_MPI
+#include <mpi.h>
+#endif
+
+void QTransport::ExchangeList(int peer, const std::vector<char> &send,
+										std::vector<char> &recv)
+//both sides send max(mine, theirs) bytes, so one Exchange() fits both
+{
+	uint64_t mine = send.size(), theirs;
+	Exchange(peer, &mine, &theirs, sizeof(mine));
+
+	size_t n = mine > theirs ? mine : theirs;
+	if (n == 0) { recv.clear(); return; }
+
+	std::vector<char> out(send);
+	out.resize(n);
+	recv.resize(n);
+	Exchange(peer, &out[0], &recv[0], n);
+	recv.resize(theirs);
+}
+
+/*
+
+The shared area holds a process-shared barrier, two counters per
+ordered pair of processes, GATHER_MAX doubles per process and one
+exchange slot of SHM_SLOT bytes per process. Each process only writes
+its own slot. An Exchange() step puts a piece into our slot, bumps
+_Sent(us,peer) and waits for _Sent(peer,us) to catch up; then it
+copies the peer's slot and does the same with _Got(), so neither slot
+is overwritten before it has been read. Only the two partners wait on
+each other, so pairs of different sizes don't hold each other up.
+
+*/
+
+struct ShmTransport::Shared {
+	pthread_barrier_t barrier;
+};
+
+static size_t Align(size_t n) { return (n + 63) & ~(size_t) 63; }
+
+volatile uint64_t *ShmTransport::_Sent(int from, int to) const
+{
+	return (volatile uint64_t *) ((char *) _shm + Align(sizeof(Shared)))
+			 + from * _size + to;
+}
+
+volatile uint64_t *ShmTransport::_Got(int from, int to) const
+{
+	return _Sent(0, 0) + _size * _size + from * _size + to;
+}
+
+double *ShmTransport::_Values(int rank) const
+{
+	return (double *) ((char *) _Sent(0, 0)
+							 + Align(2 * _size * _size * sizeof(uint64_t)))
+			 + rank * GATHER_MAX;
+}
+
+char *ShmTransport::_Slot(int rank) const
+{
+	return (char *) _Values(0) + Align(_size * GATHER_MAX * sizeof(double))
+			 + rank * SHM_SLOT;
+}
+
+static void WaitFor(volatile uint64_t *counter, uint64_t value)
+{
+	while (*counter < value) sched_yield();
+	__sync_synchronize();
+}
+
+static int Threads()
+//threads of this process, 1 if /proc can't tell
+{
+	DIR *d = opendir("/proc/self/task");
+	int n = 0;
+
+	if (d == NULL) return 1;
+	while (struct dirent *e = readdir(d))
+		if (e->d_name[0] != '.') n++;
+	closedir(d);
+	return n > 1 ? n : 1;
+}
+
+ShmTransport::ShmTransport(int size)
+	: _rank(0), _size(size), _threads(GetThreads())
+{
+	assert(size >= 1);
+	_bytes = Align(sizeof(Shared)) + Align(2 * size * size * sizeof(uint64_t))
+			 + Align(size * GATHER_MAX * sizeof(double)) + size * SHM_SLOT;
+
+	void *m = mmap(NULL, _bytes, PROT_READ | PROT_WRITE,
+						MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	assert(m != MAP_FAILED);
+	_shm = (Shared *) m;
+	memset(m, 0, Align(sizeof(Shared)) + Align(2 * size * size * sizeof(uint64_t)));
+
+	pthread_barrierattr_t attr;
+	pthread_barrierattr_init(&attr);
+	pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_barrier_init(&_shm->barrier, &attr, size);
+	pthread_barrierattr_destroy(&attr);
+
+	//The OpenMP runtime doesn't survive fork(): if this process already
+	//ran a parallel region, its worker threads are gone in the children
+	//but the runtime still counts on them, and the first region with
+	//more than one thread hangs. Such children run on one thread; else
+	//the cores are shared out between the processes.
+	int per = _threads / size > 0 ? _threads / size : 1;
+	int child = (Threads() > 1) ? 1 : per;
+
+	SetThreads(per);
+
+	//don't let the children print what is still buffered here
+	fflush(NULL);
+	for (int r = 1; r < size; r++) {
+		pid_t pid = fork();
+		assert(pid >= 0);
+		if (pid == 0) {
+			_rank = r;
+			_children.clear();
+			SetThreads(child);
+			return;
+		}
+		_children.push_back(pid);
+	}
+}
+
+void ShmTransport::Finish()
+{
+	Barrier();
+	if (_rank != 0) {
+		fflush(NULL);
+		_exit(0);
+	}
+
+	for (size_t i = 0; i < _children.size(); i++)
+		waitpid(_children[i], NULL, 0);
+	_children.clear();
+	SetThreads(_threads);
+}
+
+ShmTransport::~ShmTransport()
+//no Barrier() here: during unwinding the others may never get to it
+{
+	for (size_t i = 0; i < _children.size(); i++)
+		waitpid(_children[i], NULL, 0);
+	if (_rank == 0) pthread_barrier_destroy(&_shm->barrier);
+	munmap(_shm, _bytes);
+}
+
+void ShmTransport::Exchange(int peer, const void *send, void *recv,
+									 size_t bytes)
+{
+	if (peer == _rank) {
+		memmove(recv, send, bytes);
+		return;
+	}
+
+	for (size_t off = 0; off < bytes; off += SHM_SLOT) {
+		size_t n = bytes - off < SHM_SLOT ? bytes - off : SHM_SLOT;
+
+		memcpy(_Slot(_rank), (const char *) send + off, n);
+		uint64_t k = __sync_add_and_fetch(_Sent(_rank, peer), 1);
+		WaitFor(_Sent(peer, _rank), k);
+
+		memcpy((char *) recv + off, _Slot(peer), n);
+		__sync_add_and_fetch(_Got(_rank, peer), 1);
+		WaitFor(_Got(peer, _rank), k);
+	}
+}
+
+void ShmTransport::Gather(const double *mine, int n, double *all)
+{
+	assert(n <= GATHER_MAX);
+	memcpy(_Values(_rank), mine, n * sizeof(double));
+	Barrier();
+	for (int r = 0; r < _size; r++)
+		memcpy(all + r * n, _Values(r), n * sizeof(double));
+	Barrier();
+}
+
+void ShmTransport::Broadcast(void *data, size_t bytes, int root)
+{
+	for (size_t off = 0; off < bytes; off += SHM_SLOT) {
+		size_t n = bytes - off < SHM_SLOT ? bytes - off : SHM_SLOT;
+
+		if (_rank == root) memcpy(_Slot(root), (char *) data + off, n);
+		Barrier();
+		if (_rank != root) memcpy((char *) data + off, _Slot(root), n);
+		Barrier();
+	}
+}
+
+void ShmTransport::Barrier()
+{
+	if (_size > 1) pthread_barrier_wait(&_shm->barrier);
+}
+
+#ifdef Q_MPI
+
+//: Largest message handed to MPI at once. (counts are ints)
+static const size_t MPI_PIECE = 1 << 30;
+
+MpiTransport::MpiTransport(int *argc, char ***argv)
+	: _owner(false)
+{
+	int up;
+	MPI_Initialized(&up);
+	if (!up) {
+		MPI_Init(argc, argv);
+		_owner = true;
+	}
+	MPI_Comm_rank(MPI_COMM_WORLD, &_rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &_size);
+}
+
+MpiTransport::~MpiTransport()
+{
+	if (_owner) MPI_Finalize();
+}
+
+void MpiTransport::Exchange(int peer, const void *send, void *recv,
+									 size_t bytes)
+{
+	for (size_t off = 0; off < bytes; off += MPI_PIECE) {
+		int n = bytes - off < MPI_PIECE ? bytes - off : MPI_PIECE;
+		MPI_Sendrecv((void *) ((const char *) send + off), n, MPI_BYTE, peer, 0,
+						 (char *) recv + off, n, MPI_BYTE, peer, 0,
+						 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	}
+}
+
+void MpiTransport::Gather(const double *mine, int n, double *all)
+{
+	MPI_Allgather((void *) mine, n, MPI_DOUBLE, all, n, MPI_DOUBLE,
+					  MPI_COMM_WORLD);
+}
+
+void MpiTransport::Broadcast(void *data, size_t bytes, int root)
+{
+	for (size_t off = 0; off < bytes; off += MPI_PIECE) {
+		int n = bytes - off < MPI_PIECE ? bytes - off : MPI_PIECE;
+		MPI_Bcast((char *) data + off, n, MPI_BYTE, root, MPI_COMM_WORLD);
+	}
+}
+
+void MpiTransport::Barrier()
+{
+	MPI_Barrier(MPI_COMM_WORLD);
+}
+
+#endif
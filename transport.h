@@ -0,0 +1,170 @@
+/* transport.h
+
+Communication between the processes of a distributed state
+This file is part of the OpenQubit project.
+
+Copyright (C) 2026 OpenQubit.org
+
+Please see the CREDITS file for contributors.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+//! lib="Distributed States"
+
+/*
+
+A QDistState (see dstate.h) is split over a number of processes which
+only talk to each other through a QTransport. All processes run the
+same program; every call below is made by all of them (Exchange() only
+by the two partners) and blocks until the data is there.
+
+ShmTransport runs on one machine: its constructor forks the other
+processes, which talk through a shared memory area, so distributed
+code can be tried without a cluster:
+
+	ShmTransport net(4);			//this process and 3 forked ones
+	{
+		QDistState q(26, net);
+		...
+	}
+	net.Finish();					//the forked processes end here
+
+A forked process that never calls Finish() (an exception, say) goes on
+running the program after the transport is gone, as any other process
+would; the destructor only waits for the children and unmaps.
+
+The OpenMP runtime is not fork-safe: once a parallel region has run
+(any gate on a state of more than PAR_CHUNK pairs, or allocating one
+over MAP_MIN bytes), its worker threads don't exist in a forked copy
+and a further parallel region there would wait for them forever. So
+the forked processes run single-threaded in that case. Create the
+ShmTransport before any large state, e.g. first thing in main(), to
+give every process its share of the cores instead.
+
+MpiTransport (built with -DQ_MPI, see the Makefile) uses MPI for the
+same calls; the program is then started with mpirun as usual.
+
+*/
+
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+//: Bytes a ShmTransport process passes on per step.
+static const size_t SHM_SLOT = 1 << 20;
+
+//: Most values per process in one Gather().
+static const int GATHER_MAX = 8;
+
+class QTransport
+//: Collective operations among the processes sharing a state.
+{
+public:
+	virtual ~QTransport() {}
+
+	//: This process' number, 0..Size()-1.
+	virtual int Rank() const = 0;
+
+	//: Number of processes.
+	virtual int Size() const = 0;
+
+	//: Send bytes to peer and receive as many from it.
+	// peer must make the matching call at the same time.
+	virtual void Exchange(int peer, const void *send, void *recv,
+								 size_t bytes) = 0;
+
+	//: Collect n values from every process, in rank order, into all.
+	virtual void Gather(const double *mine, int n, double *all) = 0;
+
+	//: Copy bytes at data from process root to all others.
+	virtual void Broadcast(void *data, size_t bytes, int root) = 0;
+
+	//: Wait for all processes.
+	virtual void Barrier() = 0;
+
+	//: Exchange lists of different lengths with peer.
+	void ExchangeList(int peer, const std::vector<char> &send,
+							std::vector<char> &recv);
+};
+
+class ShmTransport : public QTransport
+//: Processes forked on this machine, talking through shared memory.
+{
+private:
+	struct Shared;							//: layout of the shared area
+	Shared *_shm;
+	size_t _bytes;							//: size of the shared area
+	int _rank, _size;
+	int _threads;							//: OpenMP threads before the fork
+	std::vector<int> _children;		//: pids, in rank 0 only
+
+	char *_Slot(int rank) const;		//: rank's exchange buffer
+	volatile uint64_t *_Sent(int from, int to) const;
+	volatile uint64_t *_Got(int from, int to) const;
+	double *_Values(int rank) const;	//: rank's Gather() input
+
+	ShmTransport(const ShmTransport&);				//not copyable
+	ShmTransport& operator= (const ShmTransport&);
+
+public:
+	//: Fork size-1 more processes; this one becomes rank 0.
+	// Each process gets GetThreads()/size threads, or one in the forked
+	// processes if OpenMP threads were already running (see above).
+	ShmTransport(int size);
+
+	//: Wait for the others. Forked processes exit here; rank 0 gets
+	// its thread count back.
+	void Finish();
+
+	//: Unmap the shared area; rank 0 also waits for the children.
+	~ShmTransport();
+
+	int Rank() const { return _rank; }
+	int Size() const { return _size; }
+	void Exchange(int peer, const void *send, void *recv, size_t bytes);
+	void Gather(const double *mine, int n, double *all);
+	void Broadcast(void *data, size_t bytes, int root);
+	void Barrier();
+};
+
+#ifdef Q_MPI
+class MpiTransport : public QTransport
+//: Processes started by mpirun.
+{
+private:
+	int _rank, _size;
+	bool _owner;							//: we called MPI_Init
+
+public:
+	//: Initialize MPI (unless the program already did).
+	MpiTransport(int *argc = NULL, char ***argv = NULL);
+
+	//: Finalize MPI if this object initialized it.
+	~MpiTransport();
+
+	int Rank() const { return _rank; }
+	int Size() const { return _size; }
+	void Exchange(int peer, const void *send, void *recv, size_t bytes);
+	void Gather(const double *mine, int n, double *all);
+	void Broadcast(void *data, size_t bytes, int root);
+	void Barrier();
+};
+#endif
+
+#endif
@@ -26,16 +26,16 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "utility.h"
 
-bool IsBitSet(int n, unsigned short i)
+bool IsBitSet(QIndex n, unsigned short i)
 //: Check if a bit is set in a number
    { return (n >> i) & 1; }
 
-char *dtob(unsigned long value, unsigned short pad = 0)
+char *dtob(QIndex value, unsigned short pad = 0)
 {
 	int numBits = count_bits(value), index = 0;
 	int length = (pad > numBits) ? pad : numBits;
 	char *result = new char[length+1];
-	unsigned int mask = 1 << (numBits - 1);
+	QIndex mask = (QIndex) 1 << (numBits - 1);
 
 	if(pad > numBits)
 	{
@@ -57,7 +57,7 @@ char *dtob(unsigned long value, unsigned short pad = 0)
    return result;
 }
 
-inline int count_bits(unsigned long value)
+int count_bits(QIndex value)
 //: Count number of bits in a number
 {
     int nbits = 0;
@@ -70,28 +70,60 @@ inline int count_bits(unsigned long value)
     return nbits ? nbits : 1;
 }
 
+int count_ones(QIndex value)
+//: Count number of set bits in a number
+{
+	int n = 0;
+	for ( ; value; value &= value - 1)
+		n++;
+	return n;
+}
+
+QIndex deposit_bits(QIndex value, QIndex mask)
+//: Spread the low bits of value over the set bits of mask
+// e.g. deposit_bits(3, 10110b) == 00110b
+{
+	QIndex result = 0, bit;
 
-unsigned long CreateMask(int bits[])
+	for ( ; mask && value; mask &= mask - 1, value >>= 1) {
+		bit = mask & -mask;		//lowest set bit of mask
+		if (value & 1) result |= bit;
+	}
+	return result;
+}
+
+QIndex extract_bits(QIndex value, QIndex mask)
+//: Gather the bits of value under mask into the low bits (inverse of
+// deposit_bits), e.g. extract_bits(00110b, 10110b) == 3
+{
+	QIndex result = 0, out = 1;
+
+	for ( ; mask; mask &= mask - 1, out <<= 1)
+		if (value & mask & -mask) result |= out;
+	return result;
+}
+
+QIndex CreateMask(int bits[])
 {
 	int bit;
-	unsigned long mask;
-	while(bit = *bits++) mask ^= (1 << bit);
+	QIndex mask = 0;
+	while(bit = *bits++) mask ^= ((QIndex) 1 << bit);
 	return mask;
 }
 
-int GCD(int a, int b)
+QIndex GCD(QIndex a, QIndex b)
 // Greatest common divisor of a,b [Euclidean algorithm]
 {
   while (a % b !=0)
   {
-    int d = a % b;
+    QIndex d = a % b;
     a = b;  
     b = d;
   }
   return(b);
 }
 
-int PeriodExtract(int v, int M, int domain)
+QIndex PeriodExtract(QIndex v, QIndex M, QIndex domain)
 
 // the function extracts period guess from FFT result
 // this is continued fraction expansion taken from
@@ -102,13 +134,13 @@ int PeriodExtract(int v, int M, int domain)
 // domain is number of states used in FFT
 
 {
-  int a0,a1,a2,p0,p1,p2,q0,q1,q2;
+  QIndex a0,a1,a2,p0,p1,p2,q0,q1,q2;
   double e0,e1,e2;
 
 
   if (v!=0) // if the period guess is 0, we will get nothing with it
   {
-    int divisor = GCD(v,domain);
+    QIndex divisor = GCD(v,domain);
     v /= divisor;
     domain /= divisor;
 
@@ -121,26 +153,26 @@ int PeriodExtract(int v, int M, int domain)
     {
 
 // starting values
-      a0 = int((double(v)/double(domain)));
-      D("a0 = %d\n",a0);
+      a0 = QIndex((double(v)/double(domain)));
+      D("a0 = %lld\n",a0);
       e0 = fabs(double(v)/double(domain) - a0);
       D("e0 = %f\n",e0);
-      a1 = int((1/e0));
-      D("a1 = %d\n",a1);
+      a1 = QIndex((1/e0));
+      D("a1 = %lld\n",a1);
       e1 = fabs(1/e0 - a1);
       D("e1 = %f\n",e1);
       p0 = a0;
       p1 = a1*a0 + 1;
       q0 = 1;
       q1 = a1;
-      D("p1 = %d\n",p1);
-      D("q1 = %d\n",q1);
+      D("p1 = %lld\n",p1);
+      D("q1 = %lld\n",q1);
       q2=0;
 // recurense starts
       while ((e1>1/domain) && (q2<M) ) //the first condition in order to
                                        //prevent overflows
       {
-        a2 = int((1/e1));
+        a2 = QIndex((1/e1));
         p2 = a2*p1 + p0;
         q2 = a2*q1 + q0;
         e2 = fabs(1/e1 - a2);
@@ -149,15 +181,15 @@ int PeriodExtract(int v, int M, int domain)
         p0 = p1;
         q1 = q2;
         p1 = p2;
-        D("p2 = %d\n",p2);
-        D("q2 = %d\n",q2);
+        D("p2 = %lld\n",p2);
+        D("q2 = %lld\n",q2);
       }
       if (q1==q2) // value from q1 was moved to q0
       {
         q1=q0;
         p1=p0;
       }
-      D("q1 = %d\n",q1);
+      D("q1 = %lld\n",q1);
     }
    else  //exact value
     {
@@ -170,27 +202,45 @@ int PeriodExtract(int v, int M, int domain)
     return(0);
 }
 
-int Reverse(int num, int nbits)
+QIndex Reverse(QIndex num, int nbits)
 // reverse bits in num
 // nbits is number of bits 
 
 {
-  int result=0;
+  QIndex result=0;
 
   for (int i=0;i<nbits;i++)
     if (IsBitSet(num,i))
-      result+=1<<(nbits-1-i);
+      result+=(QIndex) 1<<(nbits-1-i);
 
   return(result);
 }
 
+QIndex mulmod(QIndex a, QIndex b, QIndex m)
+//: a*b mod m without overflow for any 64-bit a, b < m
+{
+#ifdef __SIZEOF_INT128__
+	return (QIndex) ((unsigned __int128) a * b % m);
+#else
+	//products up to 2^63 fit; otherwise add b shifted, bit by bit
+	if (m <= 3037000499LL) return a * b % m;		//sqrt(2^63)
+
+	QIndex r = 0;
+	for (a %= m, b %= m; b > 0; b >>= 1) {
+		if (b & 1) r = (r >= m - a) ? r - (m - a) : r + a;
+		a = (a >= m - a) ? a - (m - a) : a + a;
+	}
+	return r;
+#endif
+}
+
 // Russian Peasant modular exponentiation
-int modexp(int x, int y, int m) {
-        int xx = 1;
-        int p = x % m;
+QIndex modexp(QIndex x, QIndex y, QIndex m) {
+        QIndex xx = 1 % m;
+        QIndex p = x % m;
         while(y > 0) {
-                if(y & 1) xx = (xx*p) % m;
-                p = p*p % m;
+                if(y & 1) xx = mulmod(xx,p,m);
+                p = mulmod(p,p,m);
                 y >>= 1;
         }
         return xx;
@@ -219,19 +269,19 @@ bool IsNotPrime(int n)
 } 
 */
 
-bool IsPrime(int n) {
+bool IsPrime(QIndex n) {
 	//this uses code borrowed from Bernhard Oemer
-	int i;
+	QIndex i;
 	if (n<=1) return false;
 	for (i=2; i<=floor(sqrt(n)); i++)
 		if ((n%i)==0) return false;
 	return true;
 }
 
-bool IsPrimePower(int n) {
+bool IsPrimePower(QIndex n) {
 	//code by Bernhard Oemer
-	int i;
-	int f;
+	QIndex i;
+	QIndex f=0;
 	i=2;
 	while (i<=floor(sqrt(n)) && f==0) {
 		if((n%i)==0) f=i;
@@ -31,20 +31,28 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <math.h>
 #include "debug.h"
 
-int PeriodExtract(int v, int M, int domain);
-int GCD(int a, int b);
-int Reverse(int num, int nbits);
-
-int count_bits(unsigned long value); 
-char *dtob(unsigned long value, unsigned short pad = 0);
-
-unsigned long CreateMask(int bits[]);
-bool IsBitSet(int n, unsigned short i);
-int modexp(int x, int y, int m);
+//: Type used for outcome indices and bit masks.
+// 64 bits wide, so registers of 31 qubits and more can be addressed.
+typedef long long QIndex;
+
+QIndex PeriodExtract(QIndex v, QIndex M, QIndex domain);
+QIndex GCD(QIndex a, QIndex b);
+QIndex Reverse(QIndex num, int nbits);
+
+int count_bits(QIndex value); 
+int count_ones(QIndex value);
+QIndex deposit_bits(QIndex value, QIndex mask);
+QIndex extract_bits(QIndex value, QIndex mask);
+char *dtob(QIndex value, unsigned short pad = 0);	//caller delete[]s
+
+QIndex CreateMask(int bits[]);
+bool IsBitSet(QIndex n, unsigned short i);
+QIndex mulmod(QIndex a, QIndex b, QIndex m);
+QIndex modexp(QIndex x, QIndex y, QIndex m);
 //bool IsNotPrime(int n);
 
-bool IsPrime(int n);
-bool IsPrimePower(int n);
+bool IsPrime(QIndex n);
+bool IsPrimePower(QIndex n);
 
 #endif 
 